@@ -0,0 +1,111 @@
+#include "assetloader.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+struct Item {
+    std::function<void()> work;
+    std::function<void()> finish;
+};
+
+// The thread is never destroyed, so exiting with it running is fine
+std::thread *loader = NULL;
+std::mutex loaderMutex;         // guards the queues and quit
+std::condition_variable wakeCond;
+std::deque<Item> queued;        // work not started
+std::deque<Item> done;          // work done, finish not run
+int unfinished = 0;
+bool quit = false;
+
+void loaderMain()
+{
+    for( ;; )
+    {
+        Item item;
+        {
+            std::unique_lock<std::mutex> lock(loaderMutex);
+            wakeCond.wait(lock, []{ return quit || !queued.empty(); });
+            if( quit )
+                return;
+            item = queued.front();
+            queued.pop_front();
+        }
+        item.work();
+        {
+            std::lock_guard<std::mutex> lock(loaderMutex);
+            done.push_back(item);
+        }
+    }
+}
+
+}
+
+void loaderStart()
+{
+    if( !loader )
+        loader = new std::thread(loaderMain);
+}
+
+void loaderStop()
+{
+    if( !loader )
+        return;
+    {
+        std::lock_guard<std::mutex> lock(loaderMutex);
+        quit = true;
+    }
+    wakeCond.notify_all();
+    loader->join();
+    delete loader;
+    loader = NULL;
+
+    quit = false;
+    unfinished -= (int)queued.size();
+    queued.clear();
+}
+
+void loaderSubmit(const std::function<void()> &work, const std::function<void()> &finish)
+{
+    if( !loader )
+    {
+        work();
+        finish();
+        return;
+    }
+
+    Item item = { work, finish };
+    {
+        std::lock_guard<std::mutex> lock(loaderMutex);
+        queued.push_back(item);
+        unfinished++;
+    }
+    wakeCond.notify_one();
+}
+
+int loaderPoll(float budgetMs)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for( ;; )
+    {
+        Item item;
+        {
+            std::lock_guard<std::mutex> lock(loaderMutex);
+            if( done.empty() )
+                return unfinished;
+            item = done.front();
+            done.pop_front();
+        }
+        item.finish();
+
+        std::lock_guard<std::mutex> lock(loaderMutex);
+        unfinished--;
+        std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if( elapsed.count() >= budgetMs )
+            return unfinished;
+    }
+}
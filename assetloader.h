@@ -0,0 +1,22 @@
+#ifndef ASSETLOADER_H
+#define ASSETLOADER_H
+
+#include <functional>
+
+// Loading of assets off the render thread. Each item has a work step, run
+// on the loader thread, and a finish step, run on the render thread by
+// loaderPoll once the work is done; both run in submission order. The
+// finish step is where GL calls go. Until loaderStart is called, or after
+// loaderStop, loaderSubmit runs both steps at once on the calling thread.
+
+void loaderStart();
+void loaderStop();              // waits for the item in progress, drops the rest
+
+void loaderSubmit(const std::function<void()> &work, const std::function<void()> &finish);
+
+// Runs the finish steps of the items whose work is done, until budgetMs
+// milliseconds have gone by; at least one runs if any is ready. Returns the
+// number of items not finished yet.
+int loaderPoll(float budgetMs);
+
+#endif // ASSETLOADER_H
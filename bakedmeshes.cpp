@@ -0,0 +1,13 @@
+#include "bakedmeshes.h"
+
+const BakedMesh *findBakedMesh(int kind, bool optimized, float p0, float p1, float p2, float p3)
+{
+    for( int i = 0; i < bakedMeshCount; i++ )
+    {
+        const BakedMesh &m = bakedMeshes[i];
+        if( m.kind == kind && (m.optimized != 0) == optimized && m.params[0] == p0 && m.params[1] == p1 &&
+            m.params[2] == p2 && m.params[3] == p3 )
+            return &m;
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef BAKEDMESHES_H
+#define BAKEDMESHES_H
+
+// Meshes generated at build time by the bakemeshes tool (see makefile) for
+// the primitive parameters used by the demo. Other parameters are still
+// generated at runtime. The tables use the interleaved Vertex layout and
+// are uploaded as they are; their bounds are computed when baking.
+
+#include "vertexformat.h"
+
+enum BakedMeshKind {
+    BAKED_TEAPOT,       // grid, welded
+    BAKED_SPHERE,       // radius, rings, sectors
+    BAKED_PLANE,        // xsize, zsize, xdivs, zdivs
+    BAKED_TORUS         // outerRadius, innerRadius, nsides, nrings
+};
+
+struct BakedMesh {
+    int kind;
+    float params[4];    // generator arguments, unused ones are 0
+    int optimized;      // triangles reordered as with optimizeMeshes
+    int nverts;
+    int nelements;
+    int stride;         // floats per vertex
+    int indexSize;      // bytes per index, 2 or 4
+    const float *v;
+    const float *n;
+    const float *tc;
+    const void *el;
+    float center[3];            // bounding sphere
+    float radius;
+    int nranges;                // named parts, see TeapotPart
+    const MeshRange *ranges;
+};
+
+extern const BakedMesh bakedMeshes[];
+extern const int bakedMeshCount;
+
+// Returns NULL when the mesh with these parameters was not baked
+const BakedMesh *findBakedMesh(int kind, bool optimized, float p0, float p1 = 0.0f, float p2 = 0.0f, float p3 = 0.0f);
+
+#endif // BAKEDMESHES_H
@@ -0,0 +1,181 @@
+// Build step: writes bakedmeshdata.cpp, the static tables behind bakedmeshes.h
+//     ./bakemeshes > bakedmeshdata.cpp
+
+#include <cstdio>
+#include <cmath>
+#include "bakedmeshes.h"
+#include "bounds.h"
+#include "vboteapot.h"
+#include "vbotorus.h"
+#include "vbosphere.h"
+#include "vboplane.h"
+#include "vertexformat.h"
+#include "meshopt.h"
+
+// The configurations init() asks for, each baked with the triangle order of
+// the optimizer and with the generators' own for -noopt
+static const struct {
+    int kind;
+    float params[4];
+} bakeList[] = {
+    { BAKED_TEAPOT, { 5, 1, 0, 0 } },
+    { BAKED_SPHERE, { 1.0f, 20, 30, 0 } },
+    { BAKED_PLANE,  { 10.0f, 10.0f, 2, 2 } },
+    { BAKED_TORUS,  { 0.5f, 0.25f, 20, 40 } }
+};
+
+// Degenerate patch corners of the teapot produce NaN normals, keep them as is
+static void writeFloat(const char *sep, float f)
+{
+    if( std::isnan(f) )
+        printf("%sNAN", sep);
+    else if( std::isinf(f) )
+        printf("%s%sINFINITY", sep, f < 0.0f ? "-" : "");
+    else
+        printf("%s%.8ef", sep, f);
+}
+
+static void writeFloats(const char *name, int mesh, const float *data, int count)
+{
+    printf("static const float %s%d[%d] = {", name, mesh, count);
+    for( int i = 0; i < count; i++ )
+        writeFloat(i == 0 ? "\n    " : (i % 6) ? ", " : ",\n    ", data[i]);
+    printf("\n};\n\n");
+}
+
+template <typename T>
+static void writeIndices(const char *type, int mesh, const T *data, int count)
+{
+    printf("static const %s el%d[%d] = {", type, mesh, count);
+    for( int i = 0; i < count; i++ )
+        printf("%s%u", i == 0 ? "\n    " : (i % 16) ? ", " : ",\n    ", (unsigned int)data[i]);
+    printf("\n};\n\n");
+}
+
+// Same triangle order the demo produces at runtime
+static void optimizeIndices(bool optimize, unsigned int *el, int nelements, const float *vtx, int nverts)
+{
+    if( !optimize )
+        return;
+    optimizeVertexCache(el, nelements, nverts);
+    optimizeOverdraw(el, nelements, vtx, nverts, VERTEX_FLOATS, OVERDRAW_THRESHOLD);
+}
+
+int main()
+{
+    const int nconfigs = sizeof(bakeList) / sizeof(bakeList[0]);
+    const int count = 2 * nconfigs;
+    int nverts[count], nelements[count], indexSize[count], nranges[count];
+    BoundingSphere bounds[count];
+
+    printf("// Generated by bakemeshes, do not edit\n\n#include <cmath>\n#include \"bakedmeshes.h\"\n\n");
+
+    for( int m = 0; m < count; m++ )
+    {
+        const float *p = bakeList[m % nconfigs].params;
+        const bool optimize = m < nconfigs;
+        const int stride = VERTEX_FLOATS;
+        float *vtx = 0;
+        unsigned int *el = 0;
+        unsigned short *el16 = 0;
+        MeshRange ranges[MESH_MAX_RANGES];
+        nranges[m] = 0;
+
+        switch( bakeList[m % nconfigs].kind )
+        {
+        case BAKED_TEAPOT: {
+            int grid = (int)p[0];
+            nverts[m] = TEAPOT_PATCHES * (grid + 1) * (grid + 1);
+            nelements[m] = 6 * TEAPOT_PATCHES * grid * grid;
+            vtx = new float[stride * nverts[m]];
+            el = new unsigned int[nelements[m]];
+            generatePatches(vtx, vtx + VERTEX_NORMAL_OFS, vtx + VERTEX_TEXCOORD_OFS, el, grid, false, stride, ranges);
+            nranges[m] = TEAPOT_PARTS;
+            if( p[1] != 0.0f )
+                nverts[m] = weldVertexRanges(vtx, vtx + VERTEX_NORMAL_OFS, vtx + VERTEX_TEXCOORD_OFS, stride,
+                                             el, nelements[m], ranges, TEAPOT_PARTS,
+                                             TEAPOT_WELD_TOLERANCE, TEAPOT_CREASE_ANGLE);
+            for( int r = 0; r < TEAPOT_PARTS; r++ )
+                optimizeIndices(optimize, el + ranges[r].firstElement, ranges[r].nelements, vtx, nverts[m]);
+            if( nverts[m] <= 65536 ) {
+                el16 = new unsigned short[nelements[m]];
+                packIndices16(el, nelements[m], el16);
+            }
+            break;
+        }
+        case BAKED_SPHERE: {
+            unsigned int rings = (unsigned int)p[1], sectors = (unsigned int)p[2];
+            nverts[m] = rings * sectors;
+            nelements[m] = 4 * rings * sectors;
+            vtx = new float[stride * nverts[m]];
+            unsigned short *quads = new unsigned short[nelements[m]];
+            generateSphere(vtx, vtx + VERTEX_NORMAL_OFS, vtx + VERTEX_TEXCOORD_OFS, quads, p[0], rings, sectors, stride);
+            el = new unsigned int[6 * rings * sectors];
+            nelements[m] = triangulateQuads(quads, nelements[m], nverts[m], el);
+            optimizeIndices(optimize, el, nelements[m], vtx, nverts[m]);
+            el16 = new unsigned short[nelements[m]];
+            packIndices16(el, nelements[m], el16);
+            delete [] quads;
+            break;
+        }
+        case BAKED_PLANE: {
+            int xdivs = (int)p[2], zdivs = (int)p[3];
+            nverts[m] = (xdivs + 1) * (zdivs + 1);
+            nelements[m] = 6 * xdivs * zdivs;
+            vtx = new float[stride * nverts[m]];
+            el = new unsigned int[nelements[m]];
+            generatePlane(vtx, vtx + VERTEX_NORMAL_OFS, vtx + VERTEX_TEXCOORD_OFS, el, p[0], p[1], xdivs, zdivs, stride);
+            optimizeIndices(optimize, el, nelements[m], vtx, nverts[m]);
+            break;
+        }
+        case BAKED_TORUS: {
+            int nsides = (int)p[2], nrings = (int)p[3];
+            nverts[m] = nsides * (nrings + 1);
+            nelements[m] = 6 * nsides * nrings;
+            vtx = new float[stride * nverts[m]];
+            el = new unsigned int[nelements[m]];
+            generateVerts(vtx, vtx + VERTEX_NORMAL_OFS, vtx + VERTEX_TEXCOORD_OFS, el, p[0], p[1], nrings, nsides, stride);
+            optimizeIndices(optimize, el, nelements[m], vtx, nverts[m]);
+            break;
+        }
+        }
+
+        bounds[m] = boundingSphere(vtx, nverts[m], stride);
+        writeFloats("vtx", m, vtx, stride * nverts[m]);
+        indexSize[m] = el16 ? 2 : 4;
+        if( nranges[m] ) {
+            printf("static const MeshRange ranges%d[%d] = {\n", m, nranges[m]);
+            for( int r = 0; r < nranges[m]; r++ )
+                printf("    { %d, %d, %d, %d },\n", ranges[r].firstVertex, ranges[r].nverts,
+                       ranges[r].firstElement, ranges[r].nelements);
+            printf("};\n\n");
+        }
+        if( el16 )
+            writeIndices("unsigned short", m, el16, nelements[m]);
+        else
+            writeIndices("unsigned int", m, el, nelements[m]);
+
+        delete [] vtx;
+        delete [] el;
+        delete [] el16;
+    }
+
+    printf("const BakedMesh bakedMeshes[] = {\n");
+    for( int m = 0; m < count; m++ )
+    {
+        const float *p = bakeList[m % nconfigs].params;
+        const BoundingSphere &b = bounds[m];
+        printf("    { %d, { %.8ef, %.8ef, %.8ef, %.8ef }, %d, %d, %d, %d, %d, vtx%d, vtx%d + %d, vtx%d + %d, el%d, "
+               "{ %.8ef, %.8ef, %.8ef }, %.8ef, %d, ",
+               bakeList[m % nconfigs].kind, p[0], p[1], p[2], p[3], m < nconfigs, nverts[m], nelements[m], (int)VERTEX_FLOATS, indexSize[m],
+               m, m, (int)VERTEX_NORMAL_OFS, m, (int)VERTEX_TEXCOORD_OFS, m,
+               b.center.x, b.center.y, b.center.z, b.radius, nranges[m]);
+        if( nranges[m] )
+            printf("ranges%d },\n", m);
+        else
+            printf("0 },\n");
+    }
+    printf("};\n\nconst int bakedMeshCount = %d;\n", count);
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "bounds.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define BOUNDS_HAVE_SSE 1
+#include <immintrin.h>
+#endif
+
+BoundingSphere boundingSphere(const float *v, int nverts, int stride)
+{
+    int step = stride ? stride : 3;
+    glm::vec3 lo(v[0], v[1], v[2]), hi = lo;
+    for( int i = 1; i < nverts; i++ )
+    {
+        const float *p = v + i * step;
+        lo = glm::min(lo, glm::vec3(p[0], p[1], p[2]));
+        hi = glm::max(hi, glm::vec3(p[0], p[1], p[2]));
+    }
+
+    BoundingSphere s;
+    s.center = (lo + hi) * 0.5f;
+    float r2 = 0.0f;
+    for( int i = 0; i < nverts; i++ )
+    {
+        const float *p = v + i * step;
+        glm::vec3 d = glm::vec3(p[0], p[1], p[2]) - s.center;
+        r2 = std::max(r2, glm::dot(d, d));
+    }
+    s.radius = (float)sqrt(r2);
+    return s;
+}
+
+BoundingSphere transformSphere(const BoundingSphere &s, const glm::mat4 &m)
+{
+    float scale = std::max(glm::length(glm::vec3(m[0])),
+                  std::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+    BoundingSphere t;
+    t.center = glm::vec3(m * glm::vec4(s.center, 1.0f));
+    t.radius = s.radius * scale;
+    return t;
+}
+
+BoundingSphere mergeSpheres(const BoundingSphere &a, const BoundingSphere &b)
+{
+    glm::vec3 d = b.center - a.center;
+    float dist = glm::length(d);
+    if( dist + b.radius <= a.radius )
+        return a;
+    if( dist + a.radius <= b.radius )
+        return b;
+
+    BoundingSphere s;
+    s.radius = (dist + a.radius + b.radius) * 0.5f;
+    s.center = a.center + d * ((s.radius - a.radius) / dist);
+    return s;
+}
+
+void frustumPlanes(const glm::mat4 &viewProj, glm::vec4 planes[6])
+{
+    glm::vec4 row[4];
+    for( int i = 0; i < 4; i++ )
+        row[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+
+    for( int i = 0; i < 3; i++ )
+    {
+        planes[2 * i] = row[3] + row[i];
+        planes[2 * i + 1] = row[3] - row[i];
+    }
+    for( int i = 0; i < 6; i++ )
+        planes[i] = planes[i] * (1.0f / glm::length(glm::vec3(planes[i])));
+}
+
+bool sphereInPlanes(const glm::vec4 *planes, int nplanes, const BoundingSphere &s)
+{
+    for( int i = 0; i < nplanes; i++ )
+        if( glm::dot(glm::vec3(planes[i]), s.center) + planes[i].w < -s.radius )
+            return false;
+    return true;
+}
+
+bool sphereInsidePlanes(const glm::vec4 *planes, int nplanes, const BoundingSphere &s)
+{
+    for( int i = 0; i < nplanes; i++ )
+        if( glm::dot(glm::vec3(planes[i]), s.center) + planes[i].w < s.radius )
+            return false;
+    return true;
+}
+
+int cullSpheres(const glm::vec4 *planes, int nplanes, const float *x, const float *y, const float *z,
+                const float *radius, int n, unsigned char *visible)
+{
+    int i = 0, count = 0;
+#ifdef BOUNDS_HAVE_SSE
+    for( ; i + 4 <= n; i += 4 )
+    {
+        __m128 cx = _mm_loadu_ps(x + i);
+        __m128 cy = _mm_loadu_ps(y + i);
+        __m128 cz = _mm_loadu_ps(z + i);
+        __m128 negr = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for( int p = 0; p < nplanes; p++ )
+        {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(planes[p].x)),
+                                             _mm_mul_ps(cy, _mm_set1_ps(planes[p].y))),
+                                  _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(planes[p].z)),
+                                             _mm_set1_ps(planes[p].w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negr));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for( int k = 0; k < 4; k++ )
+        {
+            visible[i + k] = (mask >> k) & 1;
+            count += visible[i + k];
+        }
+    }
+#endif
+    for( ; i < n; i++ )
+    {
+        BoundingSphere s;
+        s.center = glm::vec3(x[i], y[i], z[i]);
+        s.radius = radius[i];
+        visible[i] = sphereInPlanes(planes, nplanes, s) ? 1 : 0;
+        count += visible[i];
+    }
+    return count;
+}
+
+bool fitLightFrustum(const glm::vec3 &light, const BoundingSphere *spheres, int n,
+                     glm::mat4 &view, glm::mat4 &projection, float &fovy)
+{
+    if( n == 0 )
+        return false;
+
+    // Axis towards the spheres' common bound, then the widest angle off it
+    BoundingSphere all = spheres[0];
+    for( int i = 1; i < n; i++ )
+        all = mergeSpheres(all, spheres[i]);
+    glm::vec3 axis = all.center - light;
+    if( glm::length(axis) <= 0.0f )
+        return false;
+    axis = glm::normalize(axis);
+
+    float halfAngle = 0.0f, near = 1e30f, far = 0.0f;
+    for( int i = 0; i < n; i++ )
+    {
+        glm::vec3 d = spheres[i].center - light;
+        float dist = glm::length(d);
+        if( dist <= spheres[i].radius )
+            return false;
+
+        float off = (float)acos(std::min(std::max(glm::dot(d / dist, axis), -1.0f), 1.0f));
+        halfAngle = std::max(halfAngle, off + (float)asin(spheres[i].radius / dist));
+        // The planes are perpendicular to the axis, so depth is along it
+        float depth = glm::dot(d, axis);
+        near = std::min(near, depth - spheres[i].radius);
+        far = std::max(far, depth + spheres[i].radius);
+    }
+
+    // Past a right angle no perspective projection can hold them
+    const float maxHalfAngle = 1.4f;
+    if( halfAngle >= maxHalfAngle )
+        return false;
+
+    glm::vec3 up = fabs(axis.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    fovy = 2.0f * halfAngle * 180.0f / 3.14159265358979323846f;
+    view = glm::lookAt(light, light + axis, up);
+    projection = glm::perspective(fovy, 1.0f, std::max(near, far * 0.01f), far);
+    return true;
+}
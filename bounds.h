@@ -0,0 +1,46 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+// Bounding spheres of the meshes, and the frustum tests and light frustum
+// fitting built on them.
+
+struct BoundingSphere {
+    glm::vec3 center;
+    float radius;
+};
+
+// Sphere around the positions, centered on their bounding box. stride is in
+// floats, 0 for packed xyz.
+BoundingSphere boundingSphere(const float *v, int nverts, int stride);
+
+// Sphere bounding s after transforming it by m, scaled by its largest axis
+BoundingSphere transformSphere(const BoundingSphere &s, const glm::mat4 &m);
+
+// Smallest sphere holding both
+BoundingSphere mergeSpheres(const BoundingSphere &a, const BoundingSphere &b);
+
+// Planes of the frustum of viewProj, as (normal, distance) with the normal
+// pointing inwards: left, right, bottom, top, near, far
+void frustumPlanes(const glm::mat4 &viewProj, glm::vec4 planes[6]);
+
+// False if the sphere is entirely outside one of the planes
+bool sphereInPlanes(const glm::vec4 *planes, int nplanes, const BoundingSphere &s);
+
+// True if the sphere is entirely inside all of the planes
+bool sphereInsidePlanes(const glm::vec4 *planes, int nplanes, const BoundingSphere &s);
+
+// The same test for n spheres given as separate center and radius arrays,
+// four at a time with SSE. Sets visible[i] to 0 or 1 and returns the number
+// of visible spheres.
+int cullSpheres(const glm::vec4 *planes, int nplanes, const float *x, const float *y, const float *z,
+                const float *radius, int n, unsigned char *visible);
+
+// Light view and perspective projection from position light whose cone just
+// holds the spheres, with near and far planes bracketing them. Returns false
+// if there is nothing to fit or the light is inside one of the spheres.
+bool fitLightFrustum(const glm::vec3 &light, const BoundingSphere *spheres, int n,
+                     glm::mat4 &view, glm::mat4 &projection, float &fovy);
+
+#endif // BOUNDS_H
@@ -3,31 +3,228 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <sstream>
 #include <cmath>
 #include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <climits>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "vboteapot.h"
 #include "teapotdata.h"
 #include "vbotorus.h"
-
-int initSphere(float radius, unsigned int rings, unsigned int sectors);
-int initTeapot(int grid, glm::mat4 transform);
-int initPlane();
-int initTorus(float outerRadius, float innerRadius, int nsides, int nrings);
-void drawSphere();
-void drawTeapot();
-void drawPlane();
-void drawTorus();
-
-void loadSource(GLuint &shaderID, std::string name);
+#include "vbosphere.h"
+#include "vboplane.h"
+#include "bakedmeshes.h"
+#include "meshcache.h"
+#include "vertexformat.h"
+#include "meshopt.h"
+#include "lod.h"
+#include "uniformring.h"
+#include "geometryarena.h"
+#include "programcache.h"
+#include "diskcache.h"
+#include "shadowcascades.h"
+#include "bounds.h"
+#include "scene.h"
+#include "jobs.h"
+#include "scenefile.h"
+#include "assetloader.h"
+#include "offscreen.h"
+#include "imagefile.h"
+#include "profiler.h"
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// A mesh generated or read for the arena, waiting for its upload. Vertices
+// and indices are already in the arena's layout: generated meshes are
+// copied into verts and el, while cached and baked ones are uploaded
+// straight from the cache mapping, held until then, or the static tables.
+struct StagedMesh {
+	std::vector<Vertex> verts;
+	std::vector<GLubyte> el;        // indices of indexType
+	const Vertex *vertexData;       // what the upload reads
+	const void *indexData;
+	int nverts, nelements;
+	GLenum indexType;
+	CachedMesh cached;
+	bool mapped;                    // cached is to be released after the upload
+	BoundingSphere bounds;
+
+	StagedMesh() : mapped(false) {}
+};
+
+int initSphere(StagedMesh &mesh, float radius, unsigned int rings, unsigned int sectors);
+int initTeapot(StagedMesh &mesh, int grid, MeshRange *parts);
+int initPlane(StagedMesh &mesh, float xsize, float zsize, int xdivs, int zdivs);
+int initTorus(StagedMesh &mesh, float outerRadius, float innerRadius, int nsides, int nrings);
+// Vertex arrays of a mesh being generated. With stride 0 v, n and tc are
+// separate allocations, otherwise they point into one interleaved buffer.
+struct VertexArrays {
+	float *v, *n, *tc;
+	int stride;
+};
+
+void stageMesh(StagedMesh &mesh, const float *v, const float *n, const float *tc,
+				int nverts, int stride, const void *el, int nelements, GLenum indexType,
+				const BoundingSphere *bounds = NULL);
+int stageCachedMesh(StagedMesh &mesh, unsigned long long key, MeshRange *ranges = NULL, int nranges = 0);
+int stageBakedMesh(StagedMesh &mesh, int kind, const float *params, MeshRange *ranges = NULL);
+int vertexStride();
+VertexArrays allocVertexArrays(int nverts);
+void freeVertexArrays(VertexArrays &a);
+// Levels of a primitive from finest to coarsest, with their object space
+// error and the bounding sphere used to measure the distance to it. Levels
+// are listed before they are loaded and only drawn once resident; the
+// bounds hold those of every resident level.
+struct LodChain {
+    int nlevels;
+    ArenaMesh mesh[MAX_LODS];
+    float error[MAX_LODS];
+    bool resident[MAX_LODS];
+    int nresident;
+    BoundingSphere bounds;
+};
+int addLod(LodChain &chain, float error);
+void makeResident(LodChain &chain, int level, const ArenaMesh &mesh, const BoundingSphere &bounds);
+int chooseLod(const LodChain &chain, const glm::mat4 &modelView, float projectionScale, float maxPixels);
+void loadLod(int mesh, int level, const std::function<void(StagedMesh &)> &generate);
+// Per-draw and material uniform blocks, std140 as declared in the shaders.
+// A pass's DrawData are bound to DrawBlock a window of up to drawWindow
+// records at a time, indexed by uDrawBase + gl_DrawID. The mat3 normal
+// matrix takes three vec4 columns.
+struct DrawData {
+    glm::mat4 modelViewProj;
+    glm::mat4 modelView;
+    glm::vec4 normalMatrix[3];
+    glm::mat4 shadowMatrix;
+    int material;
+    int pad[3];
+};
+struct MaterialBlock {
+    glm::vec3 ambient;
+    float pad0;
+    glm::vec3 diffuse;
+    float pad1;
+    glm::vec3 specular;
+    float shininess;
+};
+#define DRAW_BLOCK_BINDING 0
+#define MATERIAL_BLOCK_BINDING 1
+#define MAX_MATERIALS 8 // size of uMaterials in demo.frag
+
+enum Material { MATERIAL_GOLD, MATERIAL_PERL, MATERIAL_BRONZE, MATERIAL_BRASS, MATERIAL_EMERALD, MATERIAL_COUNT };
+enum SceneMesh { MESH_SPHERE, MESH_TEAPOT, MESH_TORUS, MESH_PLANE, MESH_COUNT };
+
+// glMultiDrawElementsIndirect command layout
+struct DrawCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Commands and per-draw data of one pass, written to the uniform ring, and
+// the index type of each command's mesh. The arrays only grow; count
+// records are in use.
+struct DrawList {
+    int count;
+    std::vector<DrawCommand> commands;
+    std::vector<DrawData> data;
+    std::vector<GLenum> indexTypes;
+    GLintptr commandOffset, dataOffset;
+};
+
+// Objects of the scene, drawn in index order by both passes. Meshes loaded
+// from a scene file take the mesh ids after MESH_COUNT.
+#define SCENE_STREAM_BYTES (4 << 20)   // scene file bytes copied per chunk
+#define MAX_OBJECT_COMMANDS 3   // the teapot's body, spout side and lid
+#define DRAW_PREP_CHUNK 64      // objects per job when preparing draw records
+
+// Matrices a pass builds its draw records from. Levels are picked from
+// distances in view space; the shadow pass only fills modelViewProj, the
+// camera pass also the view space and light space matrices.
+struct PassMatrices {
+    glm::mat4 view;
+    glm::mat4 projection;
+    bool shading;
+    glm::mat4 lightViewProj;
+    float lodScale;
+    float maxPixels;
+};
+
+// Objects tested against a pass's frustum and those left to draw
+struct CullStats {
+    int tested;
+    int drawn;
+};
+
+// Shader variants: each program is demo.vert/demo.frag built with a set of
+// #defines. The depth pass gets a position-only program and the camera pass
+// one program per PCF mode, so neither branches on uniforms. The last mode
+// is a variance shadow map, whose depth pass also writes depth moments.
+enum VertexAttrib { ATTRIB_POSITION, ATTRIB_NORMAL, ATTRIB_TEXCOORD };
+#define PCF_MODES 4
+#define PCF_VSM 3
+
+// Sections of the frame timed by the profiler, in the order they are added.
+// The GPU ones must not nest.
+enum TimedSection {
+	TIME_FRAME,
+	TIME_UPLOADS,
+	TIME_CULLING,
+	TIME_DRAW_LISTS,
+	TIME_SHADOW_MAP,        // GPU too
+	TIME_SHADOW_BLUR,       // GPU too
+	TIME_SHADING,           // GPU too
+	TIME_SWAP,
+	TIME_SECTIONS
+};
+struct ShaderProgram {
+    GLuint id;
+    GLint locLightPos, locLightIntensity;
+    GLint locShadowMap, locMoments;
+    GLint locCascadeMatrices, locCascadeSplits, locCascadeCount;
+    GLint locDrawBase;
+};
+
+// One layer of the shadow map and the commands that draw it
+struct ShadowCascade {
+    glm::mat4 crop;         // light clip space to the cascade's
+    float split;            // far end of its camera slice along the view axis
+    int firstDraw;          // shadow list commands culling back faces
+    int frontFaceDraw;      // and front faces, up to endDraw
+    int endDraw;
+};
+
+void initMaterials();
+void initScene();
+bool loadSceneFile(const char *path);
+LodChain *meshLods(int mesh);
+int objectCommandCount(int object);
+int objectCommands(int object, int lod, DrawCommand *commands, glm::mat4 *models);
+void appendDraws(DrawList &list, const int *objects, int nobjects, const PassMatrices &pass);
+void submitDraws(const ShaderProgram &program, const DrawList &list, int first, int count);
+
+std::string readSource(std::string name, const std::string &defines = "");
+void loadSource(GLuint &shaderID, const std::string &source);
 void printCompileInfoLog(GLuint shadID);
 void printLinkInfoLog(GLuint programID);
 void validateProgram(GLuint programID);
+void buildProgram(ShaderProgram &program, const std::string &defines,
+                  const char *vertexFile = "shaders/demo.vert", const char *fragmentFile = "shaders/demo.frag");
 
+bool parseArguments(int argc, char *argv[]);
+int frameConversions(const std::string &pattern);
 bool init();
 void initFBO();
-void drawFBO(glm::vec3);
+void drawFBO(const DrawList &shadowDraws, const ShadowCascade *cascades, int ncascades);
+void blurMoments(int ncascades);
+bool lightUpdateDue();
+unsigned long long shadowSignature(const DrawList &shadowDraws, const ShadowCascade *cascades, int ncascades);
 void display();
 void resize(int, int);
 void idle();
@@ -35,6 +232,12 @@ void keyboard(unsigned char, int, int);
 void specialKeyboard(int, int, int);
 void mouse(int, int, int, int);
 void mouseMotion(int, int);
+void animate();
+int elapsedMs();
+int runHeadless();
+void initTimings();
+void writeTimings();
+void showTimingsHud();
 
 
 bool fullscreen = false;
@@ -50,22 +253,95 @@ float ydiff = 0.0f;
 int g_Width = 512;
 int g_Height = 512;
 int depth_texture_size = 512;
-
-GLuint cubeVAOHandle, sphereVAOHandle, teapotVAOHandle, planeVAOHandle, torusVAOHandle;
-GLuint programID;
-GLuint locUniformMVPM, locUniformMVM, locUniformNM;
-GLuint locUniformLightPos, locUniformLightIntensity;
-GLuint locUniformMaterialAmbient, locUniformMaterialDiffuse, locUniformMaterialSpecular, locUniformMaterialShininess;
-GLuint locUniformDrawingShadowMap, locUniformShadowMatrix, locUniformShadowMap;
-GLuint locUniformPCF;
-
-int numVertTeapot, numVertSphere, numVertPlane, numVertTorus;
+int parallelTeapotGrid = 16;
+bool useBakedMeshes = true;
+bool useMeshCache = true;
+bool useProgramCache = true;
+bool interleavedVertices = true;
+bool weldTeapot = true;
+bool optimizeMeshes = true;
+
+GeometryArena arena;
+bool useMultiDrawIndirect = true;
+bool usePersistentArena = true;
+std::string sceneFileName;
+
+// Meshes are generated on the loader thread and uploaded at the start of
+// each frame, for up to uploadBudgetMs; objects appear once resident
+bool asyncLoading = true;
+float uploadBudgetMs = 2.0f;
+int loadStartTime;
+ShaderProgram depthProgram, momentsProgram, blurProgram;
+ShaderProgram mainPrograms[PCF_MODES];
+ShaderProgram *currentProgram;
+
+LodChain teapotLods, sphereLods, torusLods, planeLods;
+std::vector<LodChain> importedLods;    // a single level each
+int importedMeshCount = 0;
+MeshRange teapotParts[MAX_LODS][TEAPOT_PARTS];
+float lidOpen = 0.0f;               // 0 closed, 1 fully open
+bool lidOpening = false;
+float lodPixelError = 1.0f;         // screen space error allowed in the camera pass
+float shadowLodPixelError = 4.0f;   // and in the shadow map
 
 GLuint depth_FBO, depth_texture;
 
-
-
-void loadSource(GLuint &shaderID, std::string name) 
+// Headless mode: headlessFrames frames drawn into an offscreen target in
+// place of the window, written out as images if outputPattern is set. The
+// camera pass draws to screenFBO, 0 with a window. -size is capped at
+// MAX_IMAGE_SIZE a side.
+#define MAX_IMAGE_SIZE 16384
+int headlessFrames = 0;
+std::string outputPattern;
+GLuint screenFBO = 0;
+
+// Per-pass timings, stored per pcf mode. The HUD prints them every second,
+// and with -profile every sample goes to timingsName.csv and .json on quit.
+bool showTimings = false;
+std::string timingsName;
+const char *pcfModeNames[PCF_MODES] = { "pcf 0 (1 tap)", "pcf 1 (4 taps)", "pcf 2 (49 taps)", "pcf 3 (variance)" };
+
+// Variance shadow maps: depth moments per cascade, blurred through a one
+// layer scratch texture and mipmapped after each shadow map update
+GLuint moments_texture, blur_texture, blur_FBO, blurVAO;
+GLint locBlurLayer, locBlurDirection;
+
+// Shadow cascades cover the camera frustum up to shadowDistance; with a
+// single cascade the map keeps the whole light frustum. A cascade's crop
+// is refitted with cascadePadding of its slice's size around it.
+int cascadeCount = 3;
+float cascadeLambda = 0.75f;
+float shadowDistance = 20.0f;
+float cascadePadding = 0.25f;
+
+// The light moves at most every lightUpdateFrames frames, or lightUpdateHz
+// times a second if that is set, and the shadow map is only drawn again
+// when its casters or the light matrices differ from the last map's
+bool lightAnimation = true;
+int lightUpdateFrames = 1;
+float lightUpdateHz = 0.0f;
+bool shadowMapValid = false;
+unsigned long long shadowMapSignature;
+
+// A light frustum fit grows the casters' spheres by this factor, so the
+// casters stay inside it for a while as the camera moves
+float lightFitPadding = 1.25f;
+
+// Culling counters of the last frame; the shadow pass counts one test per
+// caster and cascade
+CullStats cameraCullStats, shadowCullStats;
+
+UniformRing uniformRing;
+int drawWindow = 48;    // DrawData per DrawBlock binding, the size of uDraws
+int drawAlign = 1;      // records between offsets DrawBlock may be bound at
+GLuint materialUBO;
+Scene scene;
+std::vector<BoundingSphere> meshBounds(MESH_COUNT);   // object space sphere of each mesh id
+
+
+
+// Reads the shader source, with defines inserted after its #version line
+std::string readSource(std::string name, const std::string &defines) 
 {
 	std::ifstream f(name.c_str());
 	if (!f.is_open()) 
@@ -79,11 +355,24 @@ void loadSource(GLuint &shaderID, std::string name)
 	source = new std::string( std::istreambuf_iterator<char>(f),   
 						std::istreambuf_iterator<char>() );
 	f.close();
-   
-	*source += "\0";
-	const GLchar * data = source->c_str();
-	glShaderSource(shaderID, 1, &data, NULL);
+
+	if (!defines.empty())
+	{
+		// #line keeps the compiler's line numbers those of the file
+		std::string::size_type eol = source->find('\n');
+		eol = (eol == std::string::npos) ? source->size() : eol + 1;
+		source->insert(eol, defines + "#line 2\n");
+	}
+
+	std::string text = *source;
 	delete source;
+	return text;
+}
+
+void loadSource(GLuint &shaderID, const std::string &source) 
+{
+	const GLchar * data = source.c_str();
+	glShaderSource(shaderID, 1, &data, NULL);
 }
 
 void printCompileInfoLog(GLuint shadID) 
@@ -153,290 +442,417 @@ GLint status;
     }
 }
 
+// Compiles and links one variant, or loads its binary from the program
+// cache. Attribute locations are fixed so that every variant reads the same
+// arena VAO.
+void buildProgram(ShaderProgram &program, const std::string &defines,
+                  const char *vertexFile, const char *fragmentFile)
+{
+	std::string vertexSource = readSource(vertexFile, defines);
+	std::string fragmentSource = readSource(fragmentFile, defines);
+	program.id = glCreateProgram();
+
+	unsigned long long key = useProgramCache ? programCacheKey(vertexSource, fragmentSource) : 0;
+	if (useProgramCache && programCacheLoad(program.id, key))
+		std::cout << "Loaded cached program" << std::endl;
+	else
+	{
+		GLuint vertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+		loadSource(vertexShaderID, vertexSource);
+		std::cout << "Compiling vertex shader ..." << std::endl;
+		glCompileShader(vertexShaderID);
+		printCompileInfoLog(vertexShaderID);
+		glAttachShader(program.id, vertexShaderID);
+
+		GLuint fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+		loadSource(fragmentShaderID, fragmentSource);
+		std::cout << "Compiling fragment shader ..." << std::endl;
+		glCompileShader(fragmentShaderID);
+		printCompileInfoLog(fragmentShaderID);
+		glAttachShader(program.id, fragmentShaderID);
+
+		glBindAttribLocation(program.id, ATTRIB_POSITION, "aPosition");
+		glBindAttribLocation(program.id, ATTRIB_NORMAL, "aNormal");
+		glBindAttribLocation(program.id, ATTRIB_TEXCOORD, "aTexCoord");
+		if (useProgramCache)
+			glProgramParameteri(program.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program.id);
+		printLinkInfoLog(program.id);
+
+		// The shaders stay attached only until the program is linked
+		glDetachShader(program.id, vertexShaderID);
+		glDetachShader(program.id, fragmentShaderID);
+		glDeleteShader(vertexShaderID);
+		glDeleteShader(fragmentShaderID);
+
+		if (useProgramCache)
+			programCacheStore(program.id, key);
+	}
+	validateProgram(program.id);
+
+	program.locLightPos = glGetUniformLocation(program.id, "uLight.lightPos");
+	program.locLightIntensity = glGetUniformLocation(program.id, "uLight.intensity");
+	program.locShadowMap = glGetUniformLocation(program.id, "uShadowMap");
+	program.locMoments = glGetUniformLocation(program.id, "uMoments");
+	program.locCascadeMatrices = glGetUniformLocation(program.id, "uCascadeMatrices");
+	program.locCascadeSplits = glGetUniformLocation(program.id, "uCascadeSplits");
+	program.locCascadeCount = glGetUniformLocation(program.id, "uCascadeCount");
+	program.locDrawBase = glGetUniformLocation(program.id, "uDrawBase");
+
+	GLuint drawBlock = glGetUniformBlockIndex(program.id, "DrawBlock");
+	GLuint materialBlock = glGetUniformBlockIndex(program.id, "MaterialBlock");
+	if (drawBlock != GL_INVALID_INDEX)
+		glUniformBlockBinding(program.id, drawBlock, DRAW_BLOCK_BINDING);
+	if (materialBlock != GL_INVALID_INDEX)
+		glUniformBlockBinding(program.id, materialBlock, MATERIAL_BLOCK_BINDING);
+
+	// The shadow map always sits in texture unit 0 and its moments in unit 1
+	glUseProgram(program.id);
+	if (program.locShadowMap != -1)
+		glUniform1i(program.locShadowMap, 0);
+	if (program.locMoments != -1)
+		glUniform1i(program.locMoments, 1);
+	glUseProgram(0);
+}
+
 // END:   Carga shaders ////////////////////////////////////////////////////////////////////////////////////////////
 
 // BEGIN: Inicializa primitivas ////////////////////////////////////////////////////////////////////////////////////
 
 ///////////////////////////////////////////////////////////////////////////////
-// Init Sphere
+// Stage Mesh
 // parametros: 
-//		radius - radio de la esfera
-//      rings - nmero de anillos paralelos
-//		sectors - numero de divisiones de los anillos
-// return:
-//		nmero de vertices
+//		mesh - copia en el formato de la arena, con la esfera que la contiene
+//		v, n, tc - posiciones, normales y coordenadas de textura
+//		stride - floats entre vertices consecutivos, 0 si son arrays separados
+//		el - indices de tipo indexType
+//		bounds - esfera ya calculada, o NULL para calcularla
 ///////////////////////////////////////////////////////////////////////////////
-int initSphere(float radius, unsigned int rings, unsigned int sectors)
-{
-    const float R = 1.0f/(float)(rings-1);
-    const float S = 1.0f/(float)(sectors-1);
-	const double PI = 3.14159265358979323846;
-
-    GLfloat *sphere_vertices = new GLfloat[rings * sectors * 3];
-    GLfloat *sphere_normals = new GLfloat[rings * sectors * 3];
-    GLfloat *sphere_texcoords = new GLfloat[rings * sectors * 2];
-    GLfloat *v = sphere_vertices;
-    GLfloat *n = sphere_normals;
-    GLfloat *t = sphere_texcoords;
-    for(unsigned int r = 0; r < rings; r++) for(unsigned int s = 0; s < sectors; s++) {
-            float const y = float( sin( -PI/2 + PI * r * R ) );
-            float const x = float( cos(2*PI * s * S) * sin( PI * r * R ) );
-            float const z = float( sin(2*PI * s * S) * sin( PI * r * R ) );
-
-            *t++ = s*S;
-            *t++ = r*R;
-
-            *v++ = x * radius;
-            *v++ = y * radius;
-            *v++ = z * radius;
-
-            *n++ = x;
-            *n++ = y;
-            *n++ = z;
+void stageMesh(StagedMesh &mesh, const float *v, const float *n, const float *tc,
+				int nverts, int stride, const void *el, int nelements, GLenum indexType,
+				const BoundingSphere *bounds)
+{
+    mesh.bounds = bounds ? *bounds : boundingSphere(v, nverts, stride);
+    mesh.verts.resize(nverts);
+    if (stride == VERTEX_FLOATS)
+        memcpy(&mesh.verts[0], v, nverts * sizeof(Vertex));
+    else
+    {
+        for (int i = 0; i < nverts; i++)
+        {
+            std::copy(v + 3 * i, v + 3 * i + 3, mesh.verts[i].position);
+            std::copy(n + 3 * i, n + 3 * i + 3, mesh.verts[i].normal);
+            std::copy(tc + 2 * i, tc + 2 * i + 2, mesh.verts[i].texCoord);
+        }
     }
+    size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+    mesh.el.assign((const GLubyte *)el, (const GLubyte *)el + nelements * indexSize);
+
+    mesh.vertexData = mesh.verts.data();
+    mesh.indexData = mesh.el.data();
+    mesh.nverts = nverts;
+    mesh.nelements = nelements;
+    mesh.indexType = indexType;
+}
+
+// Stages interleaved vertices and indices in place, without copying them;
+// they have to stay valid until the upload
+static void stageMeshInPlace(StagedMesh &mesh, const float *v, int nverts, const void *el, int nelements,
+                             int indexSize, const BoundingSphere &bounds)
+{
+    mesh.vertexData = (const Vertex *)v;
+    mesh.indexData = el;
+    mesh.nverts = nverts;
+    mesh.nelements = nelements;
+    mesh.indexType = (indexSize == sizeof(GLushort)) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    mesh.bounds = bounds;
+}
 
-    GLushort *sphere_indices = new GLushort[rings * sectors * 4];
-    GLushort *i = sphere_indices;
-    for(unsigned int r = 0; r < rings; r++) for(unsigned int s = 0; s < sectors; s++) {
-            *i++ = r * sectors + s;
-            *i++ = r * sectors + (s+1);
-            *i++ = (r+1) * sectors + (s+1);
-            *i++ = (r+1) * sectors + s;
+// Stages the mesh stored under key in the mesh cache, if there is one with
+// nranges part ranges. Returns its number of indices (0 on a miss) and
+// copies its part ranges to ranges if given.
+int stageCachedMesh(StagedMesh &mesh, unsigned long long key, MeshRange *ranges, int nranges)
+{
+    CachedMesh &cached = mesh.cached;
+    if (!useMeshCache || !meshCacheLoad(key, cached, nranges))
+        return 0;
+
+    if (ranges)
+        std::copy(cached.ranges, cached.ranges + cached.nranges, ranges);
+
+    // Interleaved files are uploaded from the mapping, which the upload
+    // releases; separate arrays still have to be interleaved
+    if (cached.stride == VERTEX_FLOATS)
+    {
+        stageMeshInPlace(mesh, cached.v, cached.nverts, cached.el, cached.nelements, cached.indexSize, cached.bounds);
+        mesh.mapped = true;
     }
+    else
+    {
+        GLenum indexType = (cached.indexSize == sizeof(GLushort)) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        stageMesh(mesh, cached.v, cached.n, cached.tc, cached.nverts, cached.stride,
+                  cached.el, cached.nelements, indexType, &cached.bounds);
+        meshCacheRelease(cached);
+    }
+    return cached.nelements;
+}
 
-    glGenVertexArrays( 1, &sphereVAOHandle );
-    glBindVertexArray(sphereVAOHandle);
+// Same for the baked table with these parameters, in the layout in use and
+// the triangle order optimizeMeshes asks for
+int stageBakedMesh(StagedMesh &mesh, int kind, const float *params, MeshRange *ranges)
+{
+    const BakedMesh *baked = useBakedMeshes ? findBakedMesh(kind, optimizeMeshes, params[0], params[1], params[2], params[3]) : NULL;
+    if (!baked || baked->stride != vertexStride())
+        return 0;
+
+    BoundingSphere bounds = { glm::vec3(baked->center[0], baked->center[1], baked->center[2]), baked->radius };
+    stageMeshInPlace(mesh, baked->v, baked->nverts, baked->el, baked->nelements, baked->indexSize, bounds);
+    if (ranges)
+        std::copy(baked->ranges, baked->ranges + baked->nranges, ranges);
+    return baked->nelements;
+}
 
-    unsigned int handle[4];
-    glGenBuffers(4, handle);
+// Floats between consecutive vertices in the layout in use, 0 for separate arrays
+int vertexStride()
+{
+    return interleavedVertices ? VERTEX_FLOATS : 0;
+}
+
+// Vertex arrays of a mesh being generated, in the layout in use
+VertexArrays allocVertexArrays(int nverts)
+{
+    VertexArrays a;
+    a.stride = vertexStride();
+    if (a.stride)
+    {
+        // A single allocation the generators write interleaved into
+        a.v = new float[a.stride * nverts];
+        a.n = a.v + VERTEX_NORMAL_OFS;
+        a.tc = a.v + VERTEX_TEXCOORD_OFS;
+    }
+    else
+    {
+        a.v = new float[3 * nverts];
+        a.n = new float[3 * nverts];
+        a.tc = new float[2 * nverts];
+    }
+    return a;
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glBufferData(GL_ARRAY_BUFFER, (rings * sectors * 3) * sizeof(GLfloat), sphere_vertices, GL_STATIC_DRAW);
-	GLuint loc1 = glGetAttribLocation(programID, "aPosition");   
-	glEnableVertexAttribArray(loc1);
-	glVertexAttribPointer( loc1, 3, GL_FLOAT, GL_FALSE, 0, (GLubyte *)NULL + 0 ); 
+void freeVertexArrays(VertexArrays &a)
+{
+    delete [] a.v;
+    if (!a.stride)
+    {
+        delete [] a.n;
+        delete [] a.tc;
+    }
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glBufferData(GL_ARRAY_BUFFER, (rings * sectors * 3) * sizeof(GLfloat), sphere_normals, GL_STATIC_DRAW);
-	GLuint loc2 = glGetAttribLocation(programID, "aNormal");   
-	glEnableVertexAttribArray(loc2);
-	glVertexAttribPointer( loc2, 3, GL_FLOAT, GL_FALSE, 0, (GLubyte *)NULL + 0 ); 
+// Reorders the triangles of a generated mesh for the vertex cache and then
+// for overdraw, reporting the cache statistics before and after. With ranges
+// each part is reordered on its own so that it stays contiguous.
+void optimizeIndices(const char *name, unsigned int *el, int nelements, const VertexArrays &a, int nverts,
+                     const MeshRange *ranges = NULL, int nranges = 0)
+{
+    if (!optimizeMeshes)
+        return;
+
+    MeshRange all = { 0, nverts, 0, nelements };
+    if (!ranges)
+    {
+        ranges = &all;
+        nranges = 1;
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-    glBufferData(GL_ARRAY_BUFFER, (rings * sectors * 2) * sizeof(float), sphere_texcoords, GL_STATIC_DRAW);
-	GLuint loc3 = glGetAttribLocation(programID, "aTexCoord");   
-	glEnableVertexAttribArray(loc3);
-	glVertexAttribPointer( loc3, 2, GL_FLOAT, GL_FALSE, 0, (GLubyte *)NULL + 0 ); 
+    VertexCacheStats before = analyzeVertexCache(el, nelements, nverts, VERTEX_CACHE_SIZE);
+    for (int r = 0; r < nranges; r++)
+    {
+        optimizeVertexCache(el + ranges[r].firstElement, ranges[r].nelements, nverts);
+        optimizeOverdraw(el + ranges[r].firstElement, ranges[r].nelements, a.v, nverts, a.stride, OVERDRAW_THRESHOLD);
+    }
+    VertexCacheStats after = analyzeVertexCache(el, nelements, nverts, VERTEX_CACHE_SIZE);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, rings * sectors * 4 * sizeof(GLushort), sphere_indices, GL_STATIC_DRAW);
+    std::cout << name << ": ACMR " << before.acmr << " -> " << after.acmr
+              << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
 
-    delete [] sphere_vertices;
-    delete [] sphere_normals;
-    delete [] sphere_texcoords;
+///////////////////////////////////////////////////////////////////////////////
+// Init Sphere
+// parametros: 
+//		mesh - malla generada, en el formato de la arena
+//		radius - radio de la esfera
+//      rings - nmero de anillos paralelos
+//		sectors - numero de divisiones de los anillos
+// return:
+//		nmero de vertices
+///////////////////////////////////////////////////////////////////////////////
+int initSphere(StagedMesh &mesh, float radius, unsigned int rings, unsigned int sectors)
+{
+    int nverts = rings * sectors;
+    int nquads = rings * sectors * 4;
+    int count;
+
+    float bakedParams[4] = { radius, (float)rings, (float)sectors, 0.0f };
+    if ((count = stageBakedMesh(mesh, BAKED_SPHERE, bakedParams)))
+        return count;
+
+    float params[5] = { radius, (float)rings, (float)sectors, (float)vertexStride(), optimizeMeshes ? 1.0f : 0.0f };
+    unsigned long long key = meshCacheKey("sphere", params, 5);
+    if ((count = stageCachedMesh(mesh, key)))
+        return count;
+
+    VertexArrays sphere = allocVertexArrays(nverts);
+    GLushort *quads = new GLushort[nquads];
+    unsigned int *el = new unsigned int[rings * sectors * 6];
+
+    // The generator emits quads; the arena draws triangle lists only
+    generateSphere(sphere.v, sphere.n, sphere.tc, quads, radius, rings, sectors, sphere.stride);
+    int nelements = triangulateQuads(quads, nquads, nverts, el);
+    optimizeIndices("sphere", el, nelements, sphere, nverts);
+
+    GLushort *sphere_indices = new GLushort[nelements];
+    packIndices16(el, nelements, sphere_indices);
+    stageMesh(mesh, sphere.v, sphere.n, sphere.tc, nverts, sphere.stride,
+              sphere_indices, nelements, GL_UNSIGNED_SHORT);
+    if (useMeshCache)
+        meshCacheStore(key, sphere.v, sphere.n, sphere.tc, nverts, sphere.stride,
+                       sphere_indices, nelements, sizeof(GLushort), mesh.bounds);
+
+    freeVertexArrays(sphere);
+    delete [] quads;
+    delete [] el;
     delete [] sphere_indices;
 
-    glBindVertexArray(0);
-
-	return rings * sectors * 4;
+	return nelements;
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////
 // Init Teapot
 // parametros: 
+//		mesh - malla generada, en el formato de la arena
 //		grid - nmero de rejillas
-//		transform - matriz de tranformacin del modelo
+//		parts - rangos de las partes de la tetera (TEAPOT_PARTS)
 // return:
 //		nmero de vertices
 ///////////////////////////////////////////////////////////////////////////////
-int initTeapot(int grid, glm::mat4 transform)
+int initTeapot(StagedMesh &mesh, int grid, MeshRange *parts)
 {
     int verts = 32 * (grid + 1) * (grid + 1);
     int faces = grid * grid * 32;
-    float * v = new float[ verts * 3 ];
-    float * n = new float[ verts * 3 ];
-    float * tc = new float[ verts * 2 ];
-    unsigned int * el = new unsigned int[faces * 6];
-
-    generatePatches( v, n, tc, el, grid );
-	moveLid(grid, v, transform);
+    int count;
 
-    glGenVertexArrays( 1, &teapotVAOHandle );
-    glBindVertexArray(teapotVAOHandle);
+    float bakedParams[4] = { (float)grid, weldTeapot ? 1.0f : 0.0f, 0.0f, 0.0f };
+    if ((count = stageBakedMesh(mesh, BAKED_TEAPOT, bakedParams, parts)))
+        return count;
 
-    unsigned int handle[4];
-    glGenBuffers(4, handle);
+    // The kernel is part of the key since the separable one rounds differently
+    float params[5] = { (float)grid, (float)getTeapotKernel(), (float)vertexStride(),
+                        weldTeapot ? 1.0f : 0.0f, optimizeMeshes ? 1.0f : 0.0f };
+    unsigned long long key = meshCacheKey("teapot", params, 5);
+    if ((count = stageCachedMesh(mesh, key, parts, TEAPOT_PARTS)))
+        return count;
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * verts) * sizeof(float), v, GL_STATIC_DRAW);
-	GLuint loc1 = glGetAttribLocation(programID, "aPosition");   
-    glVertexAttribPointer( loc1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(loc1);
-
-    glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * verts) * sizeof(float), n, GL_STATIC_DRAW);
-	GLuint loc2 = glGetAttribLocation(programID, "aNormal");   
-    glVertexAttribPointer( loc2, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(loc2);
-
-    glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-    glBufferData(GL_ARRAY_BUFFER, (2 * verts) * sizeof(float), tc, GL_STATIC_DRAW);
-	GLuint loc3 = glGetAttribLocation(programID, "aTexCoord");   
-    glVertexAttribPointer( loc3, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(loc3);
+    VertexArrays teapot = allocVertexArrays(verts);
+    unsigned int * el = new unsigned int[faces * 6];
+    int nelements = 6 * faces;
+
+    // Fine grids are tessellated across the worker threads
+    // The lid is not moved here any more: it is drawn with its own command
+    // and transform
+    generatePatches( teapot.v, teapot.n, teapot.tc, el, grid, grid >= parallelTeapotGrid, teapot.stride, parts );
+
+    // Merge the vertices duplicated along patch seams, which usually lets
+    // the indices fit in 16 bits. Parts are welded separately so they can
+    // still move apart.
+    if (weldTeapot)
+        verts = weldVertexRanges(teapot.v, teapot.n, teapot.tc, teapot.stride, el, nelements,
+                                 parts, TEAPOT_PARTS, TEAPOT_WELD_TOLERANCE, TEAPOT_CREASE_ANGLE);
+    optimizeIndices("teapot", el, nelements, teapot, verts, parts, TEAPOT_PARTS);
+
+    const void *indices = el;
+    GLushort *el16 = NULL;
+    GLenum indexType = GL_UNSIGNED_INT;
+    if (verts <= 65536)
+    {
+        el16 = new GLushort[nelements];
+        packIndices16(el, nelements, el16);
+        indices = el16;
+        indexType = GL_UNSIGNED_SHORT;
+    }
+    int indexSize = el16 ? sizeof(GLushort) : sizeof(GLuint);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * faces * sizeof(unsigned int), el, GL_STATIC_DRAW);
+    stageMesh(mesh, teapot.v, teapot.n, teapot.tc, verts, teapot.stride, indices, nelements, indexType);
+    if (useMeshCache)
+        meshCacheStore(key, teapot.v, teapot.n, teapot.tc, verts, teapot.stride, indices, nelements, indexSize,
+                       mesh.bounds, parts, TEAPOT_PARTS);
 
-    delete [] v;
-    delete [] n;
+    freeVertexArrays(teapot);
     delete [] el;
-    delete [] tc;
-
-    glBindVertexArray(0);
+    delete [] el16;
 
-	return 6 * faces;
+	return nelements;
 }
 
-int initPlane(float xsize, float zsize, int xdivs, int zdivs)
+int initPlane(StagedMesh &mesh, float xsize, float zsize, int xdivs, int zdivs)
 {
-    
-    float * v = new float[3 * (xdivs + 1) * (zdivs + 1)];
-	float * n = new float[3 * (xdivs + 1) * (zdivs + 1)];
-    float * tex = new float[2 * (xdivs + 1) * (zdivs + 1)];
-    unsigned int * el = new unsigned int[6 * xdivs * zdivs];
-
-    float x2 = xsize / 2.0f;
-    float z2 = zsize / 2.0f;
-    float iFactor = (float)zsize / zdivs;
-    float jFactor = (float)xsize / xdivs;
-    float texi = 1.0f / zdivs;
-    float texj = 1.0f / xdivs;
-    float x, z;
-    int vidx = 0, tidx = 0;
-    for( int i = 0; i <= zdivs; i++ ) {
-        z = iFactor * i - z2;
-        for( int j = 0; j <= xdivs; j++ ) {
-            x = jFactor * j - x2;
-            v[vidx] = x;
-            v[vidx+1] = 0.0f;
-            v[vidx+2] = z;
-			n[vidx] = 0.0f;
-			n[vidx+1] = 1.0f;
-			n[vidx+2] = 0.0f;
-            vidx += 3;
-            tex[tidx] = j * texi;
-            tex[tidx+1] = i * texj;
-            tidx += 2;
-        }
-    }
+    int nverts = (xdivs + 1) * (zdivs + 1);
 
-    unsigned int rowStart, nextRowStart;
-    int idx = 0;
-    for( int i = 0; i < zdivs; i++ ) {
-        rowStart = i * (xdivs+1);
-        nextRowStart = (i+1) * (xdivs+1);
-        for( int j = 0; j < xdivs; j++ ) {
-            el[idx] = rowStart + j;
-            el[idx+1] = nextRowStart + j;
-            el[idx+2] = nextRowStart + j + 1;
-            el[idx+3] = rowStart + j;
-            el[idx+4] = nextRowStart + j + 1;
-            el[idx+5] = rowStart + j + 1;
-            idx += 6;
-        }
-    }
+    float params[6] = { xsize, zsize, (float)xdivs, (float)zdivs, (float)vertexStride(), optimizeMeshes ? 1.0f : 0.0f };
+    if (stageBakedMesh(mesh, BAKED_PLANE, params))
+        return 6 * xdivs * zdivs;
 
-    unsigned int handle[4];
-    glGenBuffers(4, handle);
+    unsigned long long key = meshCacheKey("plane", params, 6);
+    if (stageCachedMesh(mesh, key))
+        return 6 * xdivs * zdivs;
 
-	glGenVertexArrays( 1, &planeVAOHandle );
-    glBindVertexArray(planeVAOHandle);
-
-    glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glBufferData(GL_ARRAY_BUFFER, 3 * (xdivs+1) * (zdivs+1) * sizeof(float), v, GL_STATIC_DRAW);
-	GLuint loc1 = glGetAttribLocation(programID, "aPosition");   
-    glVertexAttribPointer( loc1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(loc1);
-
-	glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glBufferData(GL_ARRAY_BUFFER, 3 * (xdivs+1) * (zdivs+1) * sizeof(float), n, GL_STATIC_DRAW);
-	GLuint loc2 = glGetAttribLocation(programID, "aNormal");   
-    glVertexAttribPointer( loc2, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(loc2);
-
-    glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-    glBufferData(GL_ARRAY_BUFFER, 2 * (xdivs+1) * (zdivs+1) * sizeof(float), tex, GL_STATIC_DRAW);
-	GLuint loc3 = glGetAttribLocation(programID, "aTexCoord");   
-    glVertexAttribPointer( loc3, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(loc3);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * xdivs * zdivs * sizeof(unsigned int), el, GL_STATIC_DRAW);
+    VertexArrays plane = allocVertexArrays(nverts);
+    unsigned int * el = new unsigned int[6 * xdivs * zdivs];
 
-    glBindVertexArray(0);
+    generatePlane(plane.v, plane.n, plane.tc, el, xsize, zsize, xdivs, zdivs, plane.stride);
+    optimizeIndices("plane", el, 6 * xdivs * zdivs, plane, nverts);
+    stageMesh(mesh, plane.v, plane.n, plane.tc, nverts, plane.stride, el, 6 * xdivs * zdivs, GL_UNSIGNED_INT);
+    if (useMeshCache)
+        meshCacheStore(key, plane.v, plane.n, plane.tc, nverts, plane.stride, el, 6 * xdivs * zdivs, sizeof(GLuint),
+                       mesh.bounds);
     
-    delete [] v;
-	delete [] n;
-    delete [] tex;
+    freeVertexArrays(plane);
     delete [] el;
 
 	return 6 * xdivs * zdivs;
 }
 
-int initTorus(float outerRadius, float innerRadius, int nsides, int nrings) 
+int initTorus(StagedMesh &mesh, float outerRadius, float innerRadius, int nsides, int nrings) 
 {
     int faces = nsides * nrings;
     int nVerts  = nsides * (nrings+1);
 
-    // Verts
-    float * v = new float[3 * nVerts];
-    // Normals
-    float * n = new float[3 * nVerts];
-    // Tex coords
-    float * tex = new float[2 * nVerts];
+    float params[6] = { outerRadius, innerRadius, (float)nsides, (float)nrings, (float)vertexStride(), optimizeMeshes ? 1.0f : 0.0f };
+    if (stageBakedMesh(mesh, BAKED_TORUS, params))
+        return 6 * faces;
+
+    unsigned long long key = meshCacheKey("torus", params, 6);
+    if (stageCachedMesh(mesh, key))
+        return 6 * faces;
+
+    // Verts, normals and tex coords
+    VertexArrays torus = allocVertexArrays(nVerts);
     // Elements
     unsigned int * el = new unsigned int[6 * faces];
 
     // Generate the vertex data
-    generateVerts(v, n, tex, el, outerRadius, innerRadius, nrings, nsides);
-
-    // Create and populate the buffer objects
-    unsigned int handle[4];
-    glGenBuffers(4, handle);
-
-    // Create the VAO
-    glGenVertexArrays( 1, &torusVAOHandle );
-    glBindVertexArray(torusVAOHandle);
-
-    glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), v, GL_STATIC_DRAW);
-	GLuint loc1 = glGetAttribLocation(programID, "aPosition");   
-    glVertexAttribPointer( loc1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(loc1);  // Vertex position
+    generateVerts(torus.v, torus.n, torus.tc, el, outerRadius, innerRadius, nrings, nsides, torus.stride);
+    optimizeIndices("torus", el, 6 * faces, torus, nVerts);
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), n, GL_STATIC_DRAW);
-	GLuint loc2 = glGetAttribLocation(programID, "aNormal");   
-    glVertexAttribPointer( loc2, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(loc2);  // Vertex normal
+    // Copy to the arena layout for the upload
+    stageMesh(mesh, torus.v, torus.n, torus.tc, nVerts, torus.stride, el, 6 * faces, GL_UNSIGNED_INT);
+    if (useMeshCache)
+        meshCacheStore(key, torus.v, torus.n, torus.tc, nVerts, torus.stride, el, 6 * faces, sizeof(GLuint),
+                       mesh.bounds);
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-    glBufferData(GL_ARRAY_BUFFER, (2 * nVerts) * sizeof(float), tex, GL_STATIC_DRAW);
-	GLuint loc3 = glGetAttribLocation(programID, "aTexCoord");   
-    glVertexAttribPointer( loc3, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(loc3);  // texture coords
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * faces * sizeof(unsigned int), el, GL_STATIC_DRAW);
-
-	glBindVertexArray(0);
-
-    delete [] v;
-    delete [] n;
+    freeVertexArrays(torus);
     delete [] el;
-    delete [] tex;
 
 	return 6 * faces;
 }
@@ -445,27 +861,31 @@ int initTorus(float outerRadius, float innerRadius, int nsides, int nrings)
 
 void initFBO()
 {
+	// One layer per cascade
 	glGenTextures(1, &depth_texture);
-	glBindTexture(GL_TEXTURE_2D, depth_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depth_texture);
 	glActiveTexture(GL_TEXTURE0);
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, depth_texture_size,          
-				 depth_texture_size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32, depth_texture_size,          
+				 depth_texture_size, cascadeCount, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// Outside the fitted light frustum nothing casts: the border is the far plane
+	static const GLfloat farBorder[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, farBorder);
 
 	glGenFramebuffers(1, &depth_FBO);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, depth_FBO);
 
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture,0);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture, 0, 0);
 
 	glDrawBuffer(GL_NONE);
 	
@@ -475,80 +895,387 @@ void initFBO()
 	else
 		std::cout << "Frame buffer is not complete" << std::endl;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-void drawFBO(glm::vec3 ligthPos)
-{
-	glm::mat4 Projection = glm::perspective(65.0f, 1.0f, 2.0f, 6.0f);
-	glm::mat4 View = glm::lookAt(ligthPos, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFBO);
+
+	// Moments for the variance shadow map mode, filtered with mipmaps
+	glActiveTexture(GL_TEXTURE1);
+	glGenTextures(1, &moments_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, moments_texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG32F, depth_texture_size, depth_texture_size,
+				 cascadeCount, 0, GL_RG, GL_FLOAT, NULL);
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, farBorder);
+
+	// The blur reads through unit 2, so no pass samples the image it writes
+	glActiveTexture(GL_TEXTURE2);
+	glGenTextures(1, &blur_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, blur_texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG32F, depth_texture_size, depth_texture_size,
+				 1, 0, GL_RG, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glActiveTexture(GL_TEXTURE0);
 
-	glm::mat4 ModelPlane = glm::translate(glm::scale(glm::mat4(1.0), glm::vec3(1.0f, 1.0f, 1.0f)),vec3(0.0f, 0.0f, 0.0f));
-	glm::mat4 ModelSphere = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(0.5f, 0.5f, 0.5f)), vec3(-2.0f,1.0f, 2.0f));
-	glm::mat4 ModelTeapot = glm::translate(glm::rotate(glm::scale(glm::mat4(1.0f),vec3(0.25, 0.25, 0.25)), -90.0f, vec3(1.0, 0.0, 0.0)), vec3(0.0f, 0.0f, 0.0f));
-	glm::mat4 ModelTorus = glm::translate(glm::rotate(glm::mat4(1.0f), -45.0f, vec3(1.0, 0, 1.0)), vec3(-0.0f, -0.0f, 1.5f));
+	glGenFramebuffers(1, &blur_FBO);
+	// The blur's full screen triangle comes from gl_VertexID alone
+	glGenVertexArrays(1, &blurVAO);
 
-	glm::mat4 mvp;
+	buildProgram(blurProgram, "", "shaders/blur.vert", "shaders/blur.frag");
+	glUseProgram(blurProgram.id);
+	glUniform1i(glGetUniformLocation(blurProgram.id, "uSource"), 2);
+	locBlurLayer = glGetUniformLocation(blurProgram.id, "uLayer");
+	locBlurDirection = glGetUniformLocation(blurProgram.id, "uDirection");
+	glUseProgram(0);
+}
 
+void drawFBO(const DrawList &shadowDraws, const ShadowCascade *cascades, int ncascades)
+{
+    profileBegin(TIME_SHADOW_MAP);
     glBindFramebuffer(GL_FRAMEBUFFER, depth_FBO);
 	
 	
 	glViewport(0, 0, depth_texture_size, depth_texture_size); 
-	glClear(GL_DEPTH_BUFFER_BIT);
         glEnable( GL_CULL_FACE );
-        glCullFace(GL_BACK);
-
-	glUniform1i(locUniformDrawingShadowMap, 1);
-
-    mvp = Projection * View * ModelSphere;
-    glUniformMatrix4fv( locUniformMVPM, 1, GL_FALSE, &mvp[0][0] );
-    drawSphere();
-
-    glCullFace(GL_FRONT);
-   
-    mvp = Projection * View * ModelTeapot;
-    glUniformMatrix4fv( locUniformMVPM, 1, GL_FALSE, &mvp[0][0] );
-    drawTeapot();
 
-    mvp = Projection * View * ModelTorus;
-    glUniformMatrix4fv( locUniformMVPM, 1, GL_FALSE, &mvp[0][0] );
-    drawTorus();
+	// The variance mode also writes depth moments, cleared to the far plane
+	bool moments = (pcf == PCF_VSM);
+	const ShaderProgram &program = moments ? momentsProgram : depthProgram;
+	static const GLfloat farMoments[4] = { 1.0f, 1.0f, 0.0f, 0.0f };
+	glUseProgram(program.id);
+
+    // Each cascade's casters come sorted by the face they cull, one
+    // submission each, so every cascade binds windows of its own records
+    for (int i = 0; i < ncascades; i++)
+    {
+        const ShadowCascade &cascade = cascades[i];
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture, 0, i);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, moments ? moments_texture : 0, 0, i);
+        glDrawBuffer(moments ? GL_COLOR_ATTACHMENT0 : GL_NONE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        if (moments)
+            glClearBufferfv(GL_COLOR, 0, farMoments);
+        glCullFace(GL_BACK);
+        submitDraws(program, shadowDraws, cascade.firstDraw, cascade.frontFaceDraw - cascade.firstDraw);
+        glCullFace(GL_FRONT);
+        submitDraws(program, shadowDraws, cascade.frontFaceDraw, cascade.endDraw - cascade.frontFaceDraw);
+    }
+    profileEnd(TIME_SHADOW_MAP);
+    if (moments)
+    {
+        profileBegin(TIME_SHADOW_BLUR);
+        blurMoments(ncascades);
+        profileEnd(TIME_SHADOW_BLUR);
+    }
 
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, screenFBO);
     
     glDisable( GL_CULL_FACE );
 	glViewport(0,0,g_Width,g_Height);
 	glClear(GL_DEPTH_BUFFER_BIT);
 }
 
-void drawTeapot()  {
-    glBindVertexArray(teapotVAOHandle);
-    glDrawElements(GL_TRIANGLES, numVertTeapot, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+// Separable blur of each cascade's moments, horizontally into the scratch
+// layer and back vertically, then the mip chain for the filtered lookups
+void blurMoments(int ncascades)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, blur_FBO);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glViewport(0, 0, depth_texture_size, depth_texture_size);
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(blurProgram.id);
+	glBindVertexArray(blurVAO);
+	glActiveTexture(GL_TEXTURE2);
+
+	for (int i = 0; i < ncascades; i++)
+	{
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, blur_texture, 0, 0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, moments_texture);
+		glUniform1i(locBlurLayer, i);
+		glUniform2f(locBlurDirection, 1.0f / depth_texture_size, 0.0f);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, moments_texture, 0, i);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, blur_texture);
+		glUniform1i(locBlurLayer, 0);
+		glUniform2f(locBlurDirection, 0.0f, 1.0f / depth_texture_size);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, moments_texture);
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glActiveTexture(GL_TEXTURE0);
+
 	glBindVertexArray(0);
+	glEnable(GL_DEPTH_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, depth_FBO);
 }
 
-void drawSphere()  {
-    glBindVertexArray(sphereVAOHandle);
-    glDrawElements(GL_QUADS, numVertSphere, GL_UNSIGNED_SHORT, ((GLubyte *)NULL + (0)));
-	glBindVertexArray(0);
+// Lists a level that is not loaded yet and returns its index
+int addLod(LodChain &chain, float error)
+{
+    int i = chain.nlevels++;
+    chain.error[i] = error;
+    chain.resident[i] = false;
+    return i;
 }
 
-void drawPlane() {
-    glBindVertexArray(planeVAOHandle);
-    glDrawElements(GL_TRIANGLES, numVertPlane, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
-	glBindVertexArray(0);
+void makeResident(LodChain &chain, int level, const ArenaMesh &mesh, const BoundingSphere &bounds)
+{
+    chain.mesh[level] = mesh;
+    chain.resident[level] = true;
+    chain.bounds = chain.nresident++ ? mergeSpheres(chain.bounds, bounds) : bounds;
 }
 
-void drawTorus() {
-    glBindVertexArray(torusVAOHandle);
-    glDrawElements(GL_TRIANGLES, numVertTorus, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
-	glBindVertexArray(0);
+// Level of the chain to draw with this model view matrix, from the distance
+// to the nearest point of the bounding sphere. A level still loading is
+// stood in for by the nearest resident one, coarser first. The chain must
+// have a resident level.
+int chooseLod(const LodChain &chain, const glm::mat4 &modelView, float projectionScale, float maxPixels)
+{
+    float scale = std::max(glm::length(glm::vec3(modelView[0])),
+                  std::max(glm::length(glm::vec3(modelView[1])), glm::length(glm::vec3(modelView[2]))));
+    glm::vec3 center = glm::vec3(modelView * glm::vec4(chain.bounds.center, 1.0f));
+    float distance = glm::length(center) - chain.bounds.radius * scale;
+    int lod = selectLod(chain.error, chain.nlevels, scale, distance, projectionScale, maxPixels);
+    for (int d = 0; ; d++)
+    {
+        if (lod + d < chain.nlevels && chain.resident[lod + d])
+            return lod + d;
+        if (lod - d >= 0 && chain.resident[lod - d])
+            return lod - d;
+    }
+}
+
+// Generates a level on the loader thread and uploads it to the arena from
+// the render thread, after which the level can be drawn
+void loadLod(int mesh, int level, const std::function<void(StagedMesh &)> &generate)
+{
+    StagedMesh *staged = new StagedMesh;
+    loaderSubmit([=]() { generate(*staged); },
+                 [=]() {
+                     // 16-bit meshes stay 16-bit, in the arena's other index buffer
+                     ArenaMesh arenaMesh;
+                     arenaAllocate(arena, staged->nverts, staged->nelements, staged->indexType, arenaMesh);
+                     arenaWriteVertices(arena, arenaMesh, 0, staged->vertexData, staged->nverts);
+                     if (staged->indexType == GL_UNSIGNED_SHORT)
+                         arenaWriteIndices(arena, arenaMesh, 0, (const GLushort *)staged->indexData, staged->nelements);
+                     else
+                         arenaWriteIndices(arena, arenaMesh, 0, (const GLuint *)staged->indexData, staged->nelements);
+                     makeResident(*meshLods(mesh), level, arenaMesh, staged->bounds);
+                     meshBounds[mesh] = meshLods(mesh)->bounds;
+                     if (staged->mapped)
+                         meshCacheRelease(staged->cached);
+                     delete staged;
+                 });
+}
+
+LodChain *meshLods(int mesh)
+{
+    if (mesh >= MESH_COUNT)
+        return &importedLods[mesh - MESH_COUNT];
+    switch (mesh)
+    {
+    case MESH_SPHERE: return &sphereLods;
+    case MESH_TEAPOT: return &teapotLods;
+    case MESH_TORUS:  return &torusLods;
+    }
+    return &planeLods;
+}
+
+// Lid transform in teapot model space (z up), hinged at the back of the rim
+glm::mat4 lidTransform(float open)
+{
+    glm::vec3 hinge(-1.4f, 0.0f, 2.4f);
+    return glm::translate(glm::mat4(1.0f), hinge) *
+           glm::rotate(glm::mat4(1.0f), -60.0f * open, glm::vec3(0.0f, 1.0f, 0.0f)) *
+           glm::translate(glm::mat4(1.0f), -hinge);
+}
+
+static DrawCommand makeCommand(const ArenaMesh &mesh, GLuint first, GLuint count)
+{
+    DrawCommand command = { count, 1, mesh.firstIndex + first, mesh.baseVertex, 0 };
+    return command;
+}
+
+// Number of commands objectCommands gives the object at any level
+int objectCommandCount(int object)
+{
+    return scene.mesh[object] == MESH_TEAPOT ? 3 : 1;
+}
+
+// Commands drawing the scene object at this level and the model matrix of
+// each. The teapot's lid gets its own command with the lid transform on top.
+int objectCommands(int object, int lod, DrawCommand *commands, glm::mat4 *models)
+{
+    const ArenaMesh &mesh = meshLods(scene.mesh[object])->mesh[lod];
+    const glm::mat4 &world = scene.world[object];
+    if (scene.mesh[object] != MESH_TEAPOT)
+    {
+        commands[0] = makeCommand(mesh, 0, mesh.count);
+        models[0] = world;
+        return 1;
+    }
+
+    const MeshRange &lid = teapotParts[lod][TEAPOT_LID];
+    GLuint lidEnd = lid.firstElement + lid.nelements;
+    commands[0] = makeCommand(mesh, 0, lid.firstElement);
+    commands[1] = makeCommand(mesh, lidEnd, mesh.count - lidEnd);
+    commands[2] = makeCommand(mesh, lid.firstElement, lid.nelements);
+    models[0] = models[1] = world;
+    models[2] = world * lidTransform(lidOpen);
+    return 3;
+}
+
+// Moves the 16-bit records of [begin, end) ahead of the 32-bit ones, keeping
+// the order within each, so the range takes one draw call per index width
+static void groupByIndexType(DrawList &list, int begin, int end)
+{
+    std::vector<DrawCommand> wideCommands;
+    std::vector<DrawData> wideData;
+    int narrowEnd = begin;
+    for (int i = begin; i < end; i++)
+    {
+        if (list.indexTypes[i] == GL_UNSIGNED_SHORT)
+        {
+            list.commands[narrowEnd] = list.commands[i];
+            list.data[narrowEnd] = list.data[i];
+            list.indexTypes[narrowEnd++] = GL_UNSIGNED_SHORT;
+        }
+        else
+        {
+            wideCommands.push_back(list.commands[i]);
+            wideData.push_back(list.data[i]);
+        }
+    }
+    for (size_t k = 0; k < wideCommands.size(); k++)
+    {
+        list.commands[narrowEnd + k] = wideCommands[k];
+        list.data[narrowEnd + k] = wideData[k];
+        list.indexTypes[narrowEnd + k] = GL_UNSIGNED_INT;
+    }
+}
+
+// Appends the records of the objects to the list, in the order given. Each
+// object's first record is known from the command counts, so the levels,
+// matrices and commands are then filled in by the worker threads in chunks
+// of objects, and the render thread is left to submit them.
+void appendDraws(DrawList &list, const int *objects, int nobjects, const PassMatrices &pass)
+{
+    std::vector<int> first(nobjects);
+    int end = list.count;
+    for (int j = 0; j < nobjects; j++)
+    {
+        first[j] = end;
+        end += objectCommandCount(objects[j]);
+    }
+    if ((int)list.data.size() < end)
+    {
+        list.data.resize(end);
+        list.commands.resize(end);
+        list.indexTypes.resize(end);
+    }
+
+    parallelFor(nobjects, DRAW_PREP_CHUNK, [&](int begin, int stop) {
+        for (int j = begin; j < stop; j++)
+        {
+            int i = objects[j];
+            DrawCommand commands[MAX_OBJECT_COMMANDS];
+            glm::mat4 models[MAX_OBJECT_COMMANDS];
+            const LodChain &chain = *meshLods(scene.mesh[i]);
+            int lod = chooseLod(chain, pass.view * scene.world[i], pass.lodScale, pass.maxPixels);
+            int n = objectCommands(i, lod, commands, models);
+            for (int c = 0; c < n; c++)
+            {
+                DrawData &data = list.data[first[j] + c];
+                glm::mat4 mv = pass.view * models[c];
+                data.modelViewProj = pass.projection * mv;
+                if (pass.shading)
+                {
+                    glm::mat3 nm = glm::mat3(glm::transpose(glm::inverse(mv)));
+                    data.modelView = mv;
+                    for (int k = 0; k < 3; k++)
+                        data.normalMatrix[k] = glm::vec4(nm[k], 0.0f);
+                    // Light clip space; the fragment shader picks the cascade
+                    data.shadowMatrix = pass.lightViewProj * models[c];
+                }
+                data.material = scene.material[i];
+                list.commands[first[j] + c] = commands[c];
+                list.indexTypes[first[j] + c] = chain.mesh[lod].indexType;
+            }
+        }
+    });
+    groupByIndexType(list, list.count, end);
+    list.count = end;
+}
+
+// Draws list commands [first, first + count) from the arena, binding their
+// DrawData to DrawBlock in windows of at most drawWindow records. A window
+// starts at the aligned record at or before its first command, which the
+// shader reaches through uDrawBase. Within a window each run of commands
+// with one index type is drawn from that type's VAO: with multi-draw
+// indirect in one call, the shader adding gl_DrawID, otherwise one call per
+// command.
+void submitDraws(const ShaderProgram &program, const DrawList &list, int first, int count)
+{
+    if (count <= 0)
+        return;
+
+    if (useMultiDrawIndirect)
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, uniformRing.buffer);
+    for (int start = first; start < first + count; )
+    {
+        int base = start % drawAlign;
+        int n = std::min(first + count - start, drawWindow - base);
+        glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_BLOCK_BINDING, uniformRing.buffer,
+                          list.dataOffset + (start - base) * sizeof(DrawData), drawWindow * sizeof(DrawData));
+        for (int run = start, runEnd; run < start + n; run = runEnd)
+        {
+            GLenum indexType = list.indexTypes[run];
+            for (runEnd = run + 1; runEnd < start + n && list.indexTypes[runEnd] == indexType; runEnd++)
+                ;
+            const ArenaIndexBuffer &indices = arenaIndices(arena, indexType);
+            glBindVertexArray(indices.vao);
+            if (useMultiDrawIndirect)
+            {
+                glUniform1i(program.locDrawBase, base + run - start);
+                glMultiDrawElementsIndirect(GL_TRIANGLES, indexType,
+                                            ((GLubyte *)NULL + list.commandOffset + run * sizeof(DrawCommand)),
+                                            runEnd - run, 0);
+            }
+            else
+            {
+                for (int i = run; i < runEnd; i++)
+                {
+                    const DrawCommand &command = list.commands[i];
+                    glUniform1i(program.locDrawBase, base + i - start);
+                    glDrawElementsBaseVertex(GL_TRIANGLES, command.count, indexType,
+                                             ((GLubyte *)NULL + command.firstIndex * indices.size), command.baseVertex);
+                }
+            }
+        }
+        start += n;
+    }
+    if (useMultiDrawIndirect)
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
 }
 
 int main(int argc, char *argv[])
 {
+	if (!parseArguments(argc, argv))
+		return EXIT_FAILURE;
+	// GLUT cannot start without a display, which headless runs lack
+	if (headlessFrames)
+		return runHeadless();
 	glutInit(&argc, argv); 
+
 	glutInitWindowPosition(50, 50);
 	glutInitWindowSize(g_Width, g_Height);
 	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
@@ -575,6 +1302,220 @@ int main(int argc, char *argv[])
 	return EXIT_SUCCESS;
 }
 
+// Draws headlessFrames frames with an EGL context and no window, animating
+// as the idle callback would. Loading finishes before the first frame, so
+// every frame shows the whole scene. The time reported covers display()
+// and the GPU work it issues, not the readback or the files.
+int runHeadless()
+{
+	if (!offscreenCreateContext())
+		return EXIT_FAILURE;
+	GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	// A GLEW built for GLX still loads the GL entry points under EGL
+	if (err == GLEW_ERROR_NO_GLX_DISPLAY)
+		err = GLEW_OK;
+#endif
+	if (GLEW_OK != err)
+	{
+		std::cerr << "Error: " << glewGetErrorString(err) << std::endl;
+		offscreenDestroyContext();
+		return EXIT_FAILURE;
+	}
+	std::cout << "Rendering " << headlessFrames << " frames at " << g_Width << "x" << g_Height
+	          << " on " << glGetString(GL_RENDERER) << std::endl;
+
+	OffscreenTarget target;
+	if (!offscreenTargetInit(target, g_Width, g_Height))
+	{
+		offscreenDestroyContext();
+		return EXIT_FAILURE;
+	}
+	screenFBO = target.fbo;
+	init();
+	resize(g_Width, g_Height);
+	while (loaderPoll(uploadBudgetMs) > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	// A pattern with a %d conversion names a file per frame, otherwise all
+	// frames go one after another into the one file. parseArguments let
+	// through no other conversion, so the pattern is a safe format.
+	bool filePerFrame = frameConversions(outputPattern) == 1;
+	FILE *stream = NULL;
+	if (!outputPattern.empty() && !filePerFrame && !(stream = fopen(outputPattern.c_str(), "wb")))
+		std::cerr << "Cannot write " << outputPattern << std::endl;
+	std::vector<unsigned char> pixels((size_t)g_Width * g_Height * 4);
+
+	double renderMs = 0.0;
+	bool ok = true;
+	for (int frame = 0; frame < headlessFrames && ok; frame++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		display();
+		glFinish();
+		renderMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		if (filePerFrame)
+		{
+			char path[1024];
+			snprintf(path, sizeof(path), outputPattern.c_str(), frame);
+			offscreenReadPixels(target, &pixels[0]);
+			ok = writeImageFile(path, &pixels[0], g_Width, g_Height);
+			if (!ok)
+				std::cerr << "Cannot write " << path << std::endl;
+		}
+		else if (stream)
+		{
+			offscreenReadPixels(target, &pixels[0]);
+			ok = writeImage(stream, imageFormatOf(outputPattern), &pixels[0], g_Width, g_Height);
+			if (!ok)
+				std::cerr << "Cannot write " << outputPattern << std::endl;
+		}
+		animate();
+	}
+	if (stream)
+		ok = (fclose(stream) == 0) && ok;
+
+	std::cout << "Rendered " << headlessFrames << " frames in " << renderMs << " ms, "
+	          << renderMs / std::max(headlessFrames, 1) << " ms per frame" << std::endl;
+
+	if (showTimings)
+		profileReport(pcfModeNames);
+	writeTimings();
+	profileShutdown();
+
+	// Threads left waiting would block the condition variables' destructors
+	loaderStop();
+	jobsShutdown();
+	offscreenTargetDestroy(target);
+	offscreenDestroyContext();
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Conversions in an -output pattern: 1 if it names a file per frame with a
+// single %d (zero fill and width allowed), 0 if it has none, -1 for any
+// other use of %
+int frameConversions(const std::string &pattern)
+{
+	int count = 0;
+	for (size_t i = pattern.find('%'); i != std::string::npos; i = pattern.find('%', i))
+	{
+		size_t end = pattern.find_first_not_of("0123456789", i + 1);
+		if (end == std::string::npos || pattern[end] != 'd' || ++count > 1)
+			return -1;
+		i = end + 1;
+	}
+	return count;
+}
+
+// A whole number from 1 to max, with nothing after it
+bool parseCount(const char *s, int max, int &value)
+{
+	char *end;
+	long n = strtol(s, &end, 10);
+	if (end == s || *end != '\0' || n < 1 || n > max)
+		return false;
+	value = (int)n;
+	return true;
+}
+
+// Returns false, after saying why, for an argument that would leave the
+// run without a meaning
+bool parseArguments(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-nobake")
+			useBakedMeshes = false;
+		else if (arg == "-nocache")
+			useMeshCache = false;
+		else if (arg == "-noprogramcache")
+			useProgramCache = false;
+		else if (arg == "-planar")
+			interleavedVertices = false;
+		else if (arg == "-noweld")
+			weldTeapot = false;
+		else if (arg == "-noopt")
+			optimizeMeshes = false;
+		else if (arg == "-nomdi")
+			useMultiDrawIndirect = false;
+		else if (arg == "-nostorage")
+			usePersistentArena = false;
+		else if (arg == "-scene" && i + 1 < argc)
+			sceneFileName = argv[++i];
+		else if (arg == "-headless")
+		{
+			if (i + 1 == argc || !parseCount(argv[++i], INT_MAX, headlessFrames))
+			{
+				std::cerr << "-headless needs a frame count" << std::endl;
+				return false;
+			}
+		}
+		else if (arg == "-output" && i + 1 < argc)
+		{
+			outputPattern = argv[++i];
+			if (frameConversions(outputPattern) < 0)
+			{
+				std::cerr << "-output takes a file name with at most one %d in it" << std::endl;
+				return false;
+			}
+		}
+		else if (arg == "-size")
+		{
+			char extra;
+			int width, height;
+			if (i + 1 == argc || sscanf(argv[++i], "%dx%d%c", &width, &height, &extra) != 2 ||
+			    width < 1 || height < 1 || width > MAX_IMAGE_SIZE || height > MAX_IMAGE_SIZE)
+			{
+				std::cerr << "-size needs WIDTHxHEIGHT, each from 1 to " << MAX_IMAGE_SIZE << std::endl;
+				return false;
+			}
+			g_Width = width;
+			g_Height = height;
+		}
+		else if (arg == "-pcf" && i + 1 < argc)
+			pcf = std::min(std::max(atoi(argv[++i]), 0), PCF_MODES - 1);
+		else if (arg == "-hud")
+			showTimings = true;
+		else if (arg == "-profile" && i + 1 < argc)
+			timingsName = argv[++i];
+		else if (arg == "-syncload")
+			asyncLoading = false;
+		else if (arg == "-uploadms" && i + 1 < argc)
+			uploadBudgetMs = (float)atof(argv[++i]);
+		else if (arg == "-cascades" && i + 1 < argc)
+			cascadeCount = std::min(std::max(atoi(argv[++i]), 1), MAX_CASCADES);
+		else if (arg == "-lightframes" && i + 1 < argc)
+			lightUpdateFrames = std::max(atoi(argv[++i]), 1);
+		else if (arg == "-lighthz" && i + 1 < argc)
+			lightUpdateHz = (float)atof(argv[++i]);
+		else if (arg == "-lod" && i + 1 < argc)
+			lodPixelError = (float)atof(argv[++i]);
+		else if (arg == "-shadowlod" && i + 1 < argc)
+			shadowLodPixelError = (float)atof(argv[++i]);
+		else if (arg == "-kernel" && i + 1 < argc)
+		{
+			std::string name = argv[++i];
+			if (name == "scalar")
+				setTeapotKernel(TEAPOT_KERNEL_SCALAR);
+			else if (name == "simd")
+				setTeapotKernel(TEAPOT_KERNEL_SIMD);
+			else if (name == "separable")
+				setTeapotKernel(TEAPOT_KERNEL_SEPARABLE);
+			else
+				std::cerr << "Unknown teapot kernel " << name << std::endl;
+		}
+		else if (arg == "-display" || arg == "-geometry")
+			i++;    // GLUT's own, read by glutInit
+		else if (arg == "-iconic" || arg == "-indirect" || arg == "-direct" || arg == "-gldebug" || arg == "-sync")
+			;
+		else
+			std::cerr << "Unknown argument " << arg << std::endl;
+	}
+	return true;
+}
+
 bool init()
 {
 	glClearColor(0.93f, 0.93f, 0.93f, 0.0f);
@@ -585,56 +1526,338 @@ bool init()
 
 	glShadeModel(GL_SMOOTH);
 
-	programID = glCreateProgram();
-
-	GLuint vertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	loadSource(vertexShaderID, "shaders/demo.vert");
-	std::cout << "Compiling vertex shader ..." << std::endl;
-	glCompileShader(vertexShaderID);
-	printCompileInfoLog(vertexShaderID);
-	glAttachShader(programID, vertexShaderID);
-
-	GLuint fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-	loadSource(fragmentShaderID, "shaders/demo.frag");
-	std::cout << "Compiling fragment shader ..." << std::endl;
-	glCompileShader(fragmentShaderID);
-	printCompileInfoLog(fragmentShaderID);
-	glAttachShader(programID, fragmentShaderID);
-
-	glLinkProgram(programID);
-	printLinkInfoLog(programID);
-	validateProgram(programID);
-
-	numVertTeapot = initTeapot(5, glm::mat4(1.0f));
-	numVertSphere = initSphere(1.0f, 20, 30);
-	numVertPlane = initPlane(10.0f, 10.0f, 2, 2);
-	numVertTorus = initTorus(0.5f, 0.25f, 20, 40);
-	locUniformMVPM = glGetUniformLocation(programID, "uModelViewProjMatrix");
-	locUniformMVM = glGetUniformLocation(programID, "uModelViewMatrix");
-	locUniformNM = glGetUniformLocation(programID, "uNormalMatrix");
-
-	locUniformLightPos = glGetUniformLocation(programID, "uLight.lightPos");
-	locUniformLightIntensity = glGetUniformLocation(programID, "uLight.intensity");
-	locUniformMaterialAmbient = glGetUniformLocation(programID, "uMaterial.ambient");
-	locUniformMaterialDiffuse = glGetUniformLocation(programID, "uMaterial.diffuse");
-	locUniformMaterialSpecular = glGetUniformLocation(programID, "uMaterial.specular");
-	locUniformMaterialShininess = glGetUniformLocation(programID, "uMaterial.shininess");
-
-	locUniformDrawingShadowMap = glGetUniformLocation(programID, "uDrawingShadowMap");
-	locUniformShadowMatrix = glGetUniformLocation(programID, "uShadowMatrix");
-	locUniformShadowMap = glGetUniformLocation(programID, "uShadowMap");
-    locUniformShadowMap = glGetUniformLocation(programID, "uShadowMap");
-    locUniformPCF = glGetUniformLocation(programID, "uPCF");
+	// As many DrawData as one uniform block can hold, bound from offsets the
+	// buffer alignment allows
+	GLint maxBlockSize, align;
+	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize);
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+	drawWindow = maxBlockSize / sizeof(DrawData);
+	drawAlign = std::max(align / (int)sizeof(DrawData), 1);
+	std::ostringstream drawDefines;
+	drawDefines << "#define MAX_DRAWS " << drawWindow << "\n";
+
+	// Binaries from glGetProgramBinary skip compiling on later runs
+	useProgramCache = useProgramCache && programCacheSupported();
+	buildProgram(depthProgram, drawDefines.str() + "#define DEPTH_ONLY\n");
+	buildProgram(momentsProgram, drawDefines.str() + "#define DEPTH_ONLY\n#define MOMENTS\n");
+	for (int i = 0; i < PCF_MODES; i++)
+	{
+		std::ostringstream defines;
+		defines << drawDefines.str() << "#define PCF " << i << "\n";
+		buildProgram(mainPrograms[i], defines.str());
+	}
+	currentProgram = &mainPrograms[pcf];
+	initTimings();
+
+	// LOD chains around the original tessellations (teapot grid 5, sphere
+	// 20x30, torus 20x40), with one finer level for close ups
+	const float PI = 3.14159265358979323846f;
+	static const int teapotGrids[MAX_LODS] = { 10, 5, 3, 2 };
+	static const int sphereRings[MAX_LODS] = { 40, 20, 10, 6 };
+	static const int sphereSectors[MAX_LODS] = { 60, 30, 15, 8 };
+	static const int torusSides[MAX_LODS] = { 40, 20, 10, 6 };
+	static const int torusRings[MAX_LODS] = { 80, 40, 20, 12 };
+
+	// Every mesh goes into the arena, grown on demand. With buffer storage
+	// the arena stays mapped and uploads are plain copies.
+	usePersistentArena = usePersistentArena && GLEW_ARB_buffer_storage;
+	arenaInit(arena, 1 << 16, 1 << 18, ATTRIB_POSITION, ATTRIB_NORMAL, ATTRIB_TEXCOORD, usePersistentArena);
+	for (int i = 0; i < MAX_LODS; i++)
+	{
+		// Each teapot patch turns a quarter of the body, of radius 2 at most
+		addLod(teapotLods, chordError(2.0f, PI / 2 / teapotGrids[i]));
+		addLod(sphereLods, chordError(1.0f, std::max(PI / (sphereRings[i] - 1), 2 * PI / (sphereSectors[i] - 1))));
+		addLod(torusLods, std::max(chordError(0.25f, 2 * PI / torusSides[i]), chordError(0.75f, 2 * PI / torusRings[i])));
+	}
+	addLod(planeLods, 0.0f);
+
+	// Everything is generated on the loader thread, coarsest levels first so
+	// each object shows up as early as it can. Levels read nothing the render
+	// thread writes and write only their own teapotParts row.
+	loadStartTime = elapsedMs();
+	if (asyncLoading)
+		loaderStart();
+	loadLod(MESH_PLANE, 0, [](StagedMesh &mesh) { initPlane(mesh, 10.0f, 10.0f, 2, 2); });
+	for (int i = MAX_LODS - 1; i >= 0; i--)
+	{
+		loadLod(MESH_TEAPOT, i, [i](StagedMesh &mesh) {
+			initTeapot(mesh, teapotGrids[i], teapotParts[i]);
+			// The teapot's sphere must hold the lid wherever it swings
+			mesh.bounds = mergeSpheres(mesh.bounds, transformSphere(mesh.bounds, lidTransform(1.0f)));
+		});
+		loadLod(MESH_SPHERE, i, [i](StagedMesh &mesh) { initSphere(mesh, 1.0f, sphereRings[i], sphereSectors[i]); });
+		loadLod(MESH_TORUS, i, [i](StagedMesh &mesh) { initTorus(mesh, 0.5f, 0.25f, torusSides[i], torusRings[i]); });
+	}
+
+	// gl_DrawID needs the shader extension as well as the entry point
+	useMultiDrawIndirect = useMultiDrawIndirect && GLEW_ARB_multi_draw_indirect && GLEW_ARB_shader_draw_parameters;
+
+	// Both passes write their DrawBlock array and commands each frame; all
+	// shadow cascades share one list. Segments start with room for a window
+	// per block and grow with the lists.
+	uniformRingInit(uniformRing, drawWindow * sizeof(DrawData), 4, drawWindow * sizeof(DrawData));
+	initMaterials();
+	initScene();
 	
     initFBO();
 
 	return true;
 }
  
+// Materials never change: one static array, bound once for every pass
+void initMaterials()
+{
+	static const MaterialBlock materials[MATERIAL_COUNT] = {
+		{ glm::vec3(0.24725f, 0.1995f, 0.0745f), 0.0f, glm::vec3(0.75164f, 0.60648f, 0.22648f), 0.0f, glm::vec3(0.628281f, 0.555802f, 0.366065f), 52.0f },
+		{ glm::vec3(0.25f, 0.20725f, 0.20725f), 0.0f, glm::vec3(1.0f, 0.829f, 0.829f), 0.0f, glm::vec3(0.296648f, 0.296648f, 0.296648f), 12.0f },
+		{ glm::vec3(0.2125f, 0.1275f, 0.054f), 0.0f, glm::vec3(0.714f, 0.4284f, 0.18144f), 0.0f, glm::vec3(0.393548f, 0.271906f, 0.166721f), 25.0f },
+		{ glm::vec3(0.329412f, 0.223529f, 0.027451f), 0.0f, glm::vec3(0.780392f, 0.568627f, 0.113725f), 0.0f, glm::vec3(0.992157f, 0.941176f, 0.807843f), 28.0f },
+		{ glm::vec3(0.0215f, 0.1745f, 0.0215f), 0.0f, glm::vec3(0.07568f, 0.61424f, 0.07568f), 0.0f, glm::vec3(0.633f, 0.727811f, 0.633f), 28.0f },
+	};
+
+	MaterialBlock data[MAX_MATERIALS] = {};
+	for (int i = 0; i < MATERIAL_COUNT; i++)
+		data[i] = materials[i];
+
+	glGenBuffers(1, &materialUBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, materialUBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, materialUBO);
+}
+
+// The demo's objects, with the transforms its model matrices used to be
+// built from, and those of the scene file if one was given. Mesh bounds
+// grow with the levels of each chain as they become resident.
+void initScene()
+{
+	sceneInit(scene, MESH_COUNT);
+
+	int sphere = sceneAdd(scene, MESH_SPHERE, MATERIAL_GOLD, true, GL_BACK);
+	sceneSetScale(scene, sphere, vec3(0.5f, 0.5f, 0.5f));
+	sceneSetTranslation(scene, sphere, vec3(-2.0f, 1.0f, 2.0f));
+
+	int teapot = sceneAdd(scene, MESH_TEAPOT, MATERIAL_BRASS, true, GL_FRONT);
+	sceneSetScale(scene, teapot, vec3(0.25f, 0.25f, 0.25f));
+	sceneSetRotation(scene, teapot, -90.0f, vec3(1.0f, 0.0f, 0.0f));
+
+	int torus = sceneAdd(scene, MESH_TORUS, MATERIAL_EMERALD, true, GL_FRONT);
+	sceneSetRotation(scene, torus, -45.0f, vec3(1.0f, 0.0f, 1.0f));
+	sceneSetTranslation(scene, torus, vec3(0.0f, 0.0f, 1.5f));
+
+	sceneAdd(scene, MESH_PLANE, MATERIAL_PERL, false, GL_FRONT);
+
+	if (!sceneFileName.empty() && !loadSceneFile(sceneFileName.c_str()))
+		std::cerr << "Cannot load scene " << sceneFileName << std::endl;
+
+	meshBounds.resize(MESH_COUNT + importedMeshCount);
+	for (int i = 0; i < MESH_COUNT + importedMeshCount; i++)
+		meshBounds[i] = meshLods(i)->bounds;
+}
+
+// Streams the meshes of a scene file into the arena and adds its objects.
+// Blocks are copied from the file mapping straight into the arena's buffers
+// in chunks of SCENE_STREAM_BYTES, and each chunk's pages are dropped once
+// copied, so memory use stays near the chunk size whatever the file's. The
+// loader thread faults each chunk in before the render thread copies it,
+// and a mesh is drawn once its last chunk is in. The loader thread also
+// checks each index chunk; a mesh with indices past its vertices is never
+// drawn, and its later chunks are not copied.
+struct SceneStream {
+	SceneFile file;
+	int pending;        // chunks not copied yet
+	std::vector<unsigned char> bad;     // per mesh, set by the loader thread
+};
+
+struct SceneChunk {
+	int mesh;
+	bool indices;
+	int first, count;
+};
+
+static void streamChunk(SceneStream *stream, const SceneChunk &chunk)
+{
+	int m = chunk.mesh, first = chunk.first, count = chunk.count;
+	bool indices = chunk.indices;
+	const void *data = indices ? (const void *)(sceneFileIndices(stream->file, m) + first)
+	                           : (const void *)(sceneFileVertices(stream->file, m) + first);
+	size_t size = count * (indices ? sizeof(GLuint) : sizeof(Vertex));
+	loaderSubmit([=]() {
+	                 prefetchFilePages(stream->file.file, data, size);
+	                 if (indices && !sceneFileIndicesValid(stream->file, m, first, count))
+	                     stream->bad[m] = 1;
+	             },
+	             [=]() {
+	                 LodChain &chain = importedLods[m];
+	                 if (!stream->bad[m])
+	                 {
+	                     if (indices)
+	                         arenaWriteIndices(arena, chain.mesh[0], first, (const GLuint *)data, count);
+	                     else
+	                         arenaWriteVertices(arena, chain.mesh[0], first, (const Vertex *)data, count);
+	                 }
+	                 releaseFilePages(stream->file.file, data, size);
+
+	                 const SceneFileMesh &fm = stream->file.meshes[m];
+	                 if (indices && first + count == (int)fm.nelements)
+	                 {
+	                     if (stream->bad[m])
+	                         std::cerr << "Mesh " << m << " of the scene has indices past its vertices" << std::endl;
+	                     else
+	                         makeResident(chain, 0, chain.mesh[0], chain.bounds);
+	                 }
+	                 if (--stream->pending == 0)
+	                 {
+	                     sceneFileRelease(stream->file);
+	                     delete stream;
+	                 }
+	             });
+}
+
+bool loadSceneFile(const char *path)
+{
+	SceneStream *stream = new SceneStream;
+	SceneFile &file = stream->file;
+	if (!sceneFileLoad(path, file))
+	{
+		delete stream;
+		return false;
+	}
+
+	// Chunks finishing later refer to the chains by index, so the array is
+	// sized once here
+	int nmeshes = file.nmeshes;
+	importedLods.resize(nmeshes);
+	stream->bad.assign(nmeshes, 0);
+
+	// Room for every mesh up front, so the arena grows at most once, and
+	// each mesh's range allocated before any of its chunks arrives
+	int nverts = 0, nindices = 0;
+	for (int m = 0; m < nmeshes; m++)
+	{
+		nverts += file.meshes[m].nverts;
+		nindices += file.meshes[m].nelements;
+	}
+	arenaReserve(arena, arena.nverts + nverts, GL_UNSIGNED_INT, arena.indices32.nindices + nindices);
+
+	const int vertexChunk = SCENE_STREAM_BYTES / sizeof(Vertex);
+	const int indexChunk = SCENE_STREAM_BYTES / sizeof(GLuint);
+	std::vector<SceneChunk> chunks;
+	for (int m = 0; m < nmeshes; m++)
+	{
+		const SceneFileMesh &fm = file.meshes[m];
+		LodChain &chain = importedLods[m];
+		chain.nlevels = chain.nresident = 0;
+		addLod(chain, 0.0f);
+		arenaAllocate(arena, fm.nverts, fm.nelements, GL_UNSIGNED_INT, chain.mesh[0]);
+		chain.bounds.center = glm::vec3(fm.center[0], fm.center[1], fm.center[2]);
+		chain.bounds.radius = fm.radius;
+
+		for (int first = 0; first < (int)fm.nverts; first += vertexChunk)
+		{
+			SceneChunk chunk = { m, false, first, std::min(vertexChunk, (int)fm.nverts - first) };
+			chunks.push_back(chunk);
+		}
+		for (int first = 0; first < (int)fm.nelements; first += indexChunk)
+		{
+			SceneChunk chunk = { m, true, first, std::min(indexChunk, (int)fm.nelements - first) };
+			chunks.push_back(chunk);
+		}
+	}
+	importedMeshCount = nmeshes;
+
+	// Imported meshes may be open, so their shadows come from front faces
+	sceneReserve(scene, scene.count + file.nobjects);
+	for (int i = 0; i < file.nobjects; i++)
+	{
+		const SceneFileObject &o = file.objects[i];
+		int material = std::min(std::max(o.material, 0), MATERIAL_COUNT - 1);
+		int object = sceneAdd(scene, MESH_COUNT + o.mesh, material, o.castsShadow != 0, GL_BACK);
+		sceneSetTranslation(scene, object, glm::vec3(o.translation[0], o.translation[1], o.translation[2]));
+		if (o.angle != 0.0f)
+			sceneSetRotation(scene, object, o.angle, glm::vec3(o.axis[0], o.axis[1], o.axis[2]));
+		sceneSetScale(scene, object, glm::vec3(o.scale[0], o.scale[1], o.scale[2]));
+	}
+
+	// The last chunk releases the file. Without a loader thread chunks are
+	// copied as they are submitted, so the stream is not touched after this.
+	stream->pending = (int)chunks.size();
+	if (chunks.empty())
+	{
+		sceneFileRelease(file);
+		delete stream;
+	}
+	for (size_t i = 0; i < chunks.size(); i++)
+		streamChunk(stream, chunks[i]);
+	return true;
+}
+ 
+// Whether the light may move this frame, from the update cadence
+bool lightUpdateDue()
+{
+	static int frames = 0;
+	static int lastUpdate = 0;
+
+	if (lightUpdateHz > 0.0f)
+	{
+		int now = elapsedMs();
+		if (now - lastUpdate < 1000.0f / lightUpdateHz)
+			return false;
+		lastUpdate = now;
+		return true;
+	}
+	if (++frames < lightUpdateFrames)
+		return false;
+	frames = 0;
+	return true;
+}
+
+// Hash of everything the shadow map depends on: the commands drawn and the
+// light space matrix of each, which covers the light, the cascades, caster
+// transforms, levels of detail and the teapot lid. The ranges of each
+// cascade are hashed too, since moving a caster between the cull face
+// halves leaves the commands alone.
+unsigned long long shadowSignature(const DrawList &shadowDraws, const ShadowCascade *cascades, int ncascades)
+{
+	unsigned long long h = hashBytes(&shadowDraws.count, sizeof(shadowDraws.count));
+	h = hashBytes(shadowDraws.commands.data(), shadowDraws.count * sizeof(DrawCommand), h);
+	h = hashBytes(shadowDraws.indexTypes.data(), shadowDraws.count * sizeof(GLenum), h);
+	for (int i = 0; i < shadowDraws.count; i++)
+		h = hashBytes(&shadowDraws.data[i].modelViewProj, sizeof(glm::mat4), h);
+	for (int i = 0; i < ncascades; i++)
+	{
+		int ranges[3] = { cascades[i].firstDraw, cascades[i].frontFaceDraw, cascades[i].endDraw };
+		h = hashBytes(ranges, sizeof(ranges), h);
+	}
+	return h;
+}
+
 void display()
 {
+	profileBeginFrame(pcf);
+	profileBegin(TIME_FRAME);
+
+	// Uploads of the meshes the loader has finished, within the budget
+	static bool loading = true;
+	profileBegin(TIME_UPLOADS);
+	if (loading && loaderPoll(uploadBudgetMs) == 0)
+	{
+		loading = false;
+		std::cout << "Assets loaded in " << elapsedMs() - loadStartTime << " ms" << std::endl;
+	}
+	profileEnd(TIME_UPLOADS);
+
+	// The light angle advances every frame but is applied on light updates
+	// only, so it keeps its speed whatever the cadence
 	static float angle = 0.0f;
-	angle += 0.0005f;
+	static float pendingAngle = 0.0f;
+	if (lightAnimation)
+		pendingAngle += 0.0005f;
+	if (lightUpdateDue())
+	{
+		angle += pendingAngle;
+		pendingAngle = 0.0f;
+	}
 
 	struct LightInfo {
 	 glm::vec4 lightPos;
@@ -644,122 +1867,303 @@ void display()
 						glm::vec3(1.0f, 1.0f, 1.0f), 
 	};
 
-	struct MaterialInfo {
-		glm::vec3 ambient;
-		glm::vec3 diffuse;
-		glm::vec3 specular;
-		GLfloat shininess;
-	};
-	MaterialInfo gold = {glm::vec3(0.24725f, 0.1995f, 0.0745f), glm::vec3(0.75164f, 0.60648f, 0.22648f), glm::vec3(0.628281f, 0.555802f, 0.366065f), 52.0f};
-	MaterialInfo perl = {glm::vec3(0.25f, 0.20725f, 0.20725f), glm::vec3(1.0f, 0.829f, 0.829f), glm::vec3(0.296648f, 0.296648f, 0.296648f), 12.0f};
-	MaterialInfo bronze = {glm::vec3(0.2125f, 0.1275f, 0.054f), glm::vec3(0.714f, 0.4284f, 0.18144f), glm::vec3(0.393548f, 0.271906f, 0.166721f), 25.0f};
-	MaterialInfo brass = {glm::vec3(0.329412f, 0.223529f, 0.027451f), glm::vec3(0.780392f, 0.568627f, 0.113725f), glm::vec3(0.992157f, 0.941176f, 0.807843f), 28.0f};
-	MaterialInfo emerald = {glm::vec3(0.0215f, 0.1745f, 0.0215f), glm::vec3(0.07568f, 0.61424f, 0.07568f), glm::vec3(0.633f, 0.727811f, 0.633f), 28.0f};
-
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glm::mat4 Projection = glm::perspective(45.0f, 1.0f * g_Width / g_Height, 1.0f, 100.0f);
+	const float fovy = 45.0f, nearPlane = 1.0f;
+	float aspect = 1.0f * g_Width / g_Height;
+	glm::mat4 Projection = glm::perspective(fovy, aspect, nearPlane, 100.0f);
+	float lodScale = lodProjectionScale(45.0f, g_Height);
 	
 	glm::vec3 cameraPos = vec3( 5.0f * cos( yrot / 150 ), 2.0f * sin(xrot / 150) + 3.0f, 5.0f * sin( yrot / 150 ) * cos(xrot /150) );
 	glm::mat4 View = glm::lookAt(cameraPos, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
-	glm::mat4 ModelPlane = glm::translate(glm::scale(glm::mat4(1.0), glm::vec3(1.0f, 1.0f, 1.0f)),vec3(0.0f, 0.0f, 0.0f));
-	glm::mat4 ModelSphere = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(0.5f, 0.5f, 0.5f)), vec3(-2.0f,1.0f, 2.0f));
-	glm::mat4 ModelTeapot = glm::translate(glm::rotate(glm::scale(glm::mat4(1.0f),vec3(0.25, 0.25, 0.25)), -90.0f, vec3(1.0, 0.0, 0.0)), vec3(0.0f, 0.0f, 0.0f));
-	glm::mat4 ModelTorus = glm::translate(glm::rotate(glm::mat4(1.0f), -45.0f, vec3(1.0, 0, 1.0)), vec3(-0.0f, -0.0f, 1.5f));
-
-	glm::mat4 mvp;
-	glm::mat4 mv;
-	glm::mat3 nm;
-
-	glUseProgram(programID);
-
-    drawFBO(glm::vec3(light.lightPos));
+	// The light frustum is fitted to the casters that can shadow what the
+	// camera sees: those inside the camera frustum, or outside only planes
+	// the light is also outside of, since their shadows may fall inside
+	glm::vec3 lightPos = glm::vec3(light.lightPos);
+	glm::vec4 cameraPlanes[6], casterPlanes[6];
+	int ncasterPlanes = 0;
+	frustumPlanes(Projection * View, cameraPlanes);
+	for (int i = 0; i < 6; i++)
+		if (glm::dot(glm::vec3(cameraPlanes[i]), lightPos) + cameraPlanes[i].w >= 0.0f)
+			casterPlanes[ncasterPlanes++] = cameraPlanes[i];
+
+	// World matrices and world space spheres of every object, computed once
+	// for both passes; the spheres are already arrays for the batch tests
+	profileBegin(TIME_CULLING);
+	sceneUpdate(scene, meshBounds.data());
+	const float *boundsX = scene.boundsX, *boundsY = scene.boundsY, *boundsZ = scene.boundsZ;
+	const float *boundsR = scene.boundsR;
+
+	// Per-object results of this frame, kept between frames for their storage
+	static std::vector<unsigned char> cameraVisible, casterInView, caster, inCascade;
+	static std::vector<BoundingSphere> casterBounds;
+	static std::vector<int> objects;
+	cameraVisible.resize(scene.count);
+	casterInView.resize(scene.count);
+	caster.resize(scene.count);
+	inCascade.resize(scene.count);
+	casterBounds.resize(scene.count);
+	objects.resize(scene.count);
+
+	cameraCullStats.tested = scene.count;
+	cameraCullStats.drawn = cullSpheres(cameraPlanes, 6, boundsX, boundsY, boundsZ, boundsR,
+	                                    scene.count, cameraVisible.data());
+	cullSpheres(casterPlanes, ncasterPlanes, boundsX, boundsY, boundsZ, boundsR, scene.count, casterInView.data());
+
+	// Objects whose meshes are still loading are left out of both passes
+	for (int i = 0; i < scene.count; i++)
+	{
+		caster[i] = scene.castsShadow[i];
+		if (meshLods(scene.mesh[i])->nresident == 0)
+		{
+			cameraCullStats.drawn -= cameraVisible[i];
+			cameraVisible[i] = casterInView[i] = caster[i] = 0;
+		}
+	}
 
-	glUniform1i(locUniformDrawingShadowMap, 0);
-	glUniform1i(locUniformShadowMap, 0);
-        glUniform1i(locUniformPCF, pcf);
+	int ncasters = 0;
+	for (int i = 0; i < scene.count; i++)
+	{
+		casterInView[i] = casterInView[i] && scene.castsShadow[i];
+		if (casterInView[i])
+		{
+			casterBounds[ncasters].center = glm::vec3(boundsX[i], boundsY[i], boundsZ[i]);
+			casterBounds[ncasters++].radius = boundsR[i];
+		}
+	}
 
-	glm::mat4 ProjectionLight = glm::perspective(65.0f, 1.0f, 2.0f, 6.0f);
-	glm::mat4 ViewLight = glm::lookAt(glm::vec3(light.lightPos), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	// The fitted frustum is kept while the light stays put and those casters
+	// are all still inside it, so moving the camera alone leaves it, and the
+	// shadow map, as they were. A refit pads the casters.
+	static bool lightFitValid = false, lightFitFixed;
+	static float lightFitAngle;
+	static float lightFovy;
+	static glm::mat4 ProjectionLight, ViewLight;
+	bool refitLight = !lightFitValid || lightFitAngle != angle || (lightFitFixed && ncasters > 0);
+	if (!refitLight)
+	{
+		glm::vec4 lightPlanes[6];
+		frustumPlanes(ProjectionLight * ViewLight, lightPlanes);
+		for (int i = 0; i < ncasters && !refitLight; i++)
+			refitLight = !sphereInsidePlanes(lightPlanes, 6, casterBounds[i]);
+	}
+	if (refitLight)
+	{
+		std::vector<BoundingSphere> padded(casterBounds.begin(), casterBounds.begin() + ncasters);
+		for (int i = 0; i < ncasters; i++)
+			padded[i].radius *= lightFitPadding;
+
+		// Without casters to fit, or with the light among them, the old
+		// fixed frustum looking at the origin
+		lightFitFixed = !fitLightFrustum(lightPos, padded.data(), ncasters, ViewLight, ProjectionLight, lightFovy) &&
+		                !fitLightFrustum(lightPos, casterBounds.data(), ncasters, ViewLight, ProjectionLight, lightFovy);
+		if (lightFitFixed)
+		{
+			lightFovy = 65.0f;
+			ProjectionLight = glm::perspective(lightFovy, 1.0f, 2.0f, 6.0f);
+			ViewLight = glm::lookAt(lightPos, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		}
+		lightFitValid = true;
+		lightFitAngle = angle;
+	}
+	// The shadow map tolerates coarser levels than the camera pass
+	float shadowLodScale = lodProjectionScale(lightFovy, depth_texture_size);
 
 	glm::mat4 B(0.5f, 0.0f, 0.0f, 0.0f,
                     0.0f, 0.5f, 0.0f, 0.0f,
                     0.0f, 0.0f, 0.5f, 0.0f,
                     0.5f, 0.5f, 0.5f, 1.0f);
-        glm::mat4 S;
-
-
-	mv = View;
-	nm = glm::mat3(glm::transpose(glm::inverse(mv)));
-	glm::vec4 lpos = mv * light.lightPos;
-	glUniform4fv(locUniformLightPos, 1, &(lpos.x));
-	glUniform3fv(locUniformLightIntensity, 1, &(light.intensity.r));
-
-
-    S = B * ProjectionLight * ViewLight * ModelSphere;
-	mvp = Projection * View * ModelSphere;
-	mv = View * ModelSphere;
-	nm = glm::mat3(glm::transpose(glm::inverse(mv)));
-	glUniformMatrix4fv( locUniformMVPM, 1, GL_FALSE, &mvp[0][0] );
-	glUniformMatrix4fv( locUniformMVM, 1, GL_FALSE, &mv[0][0] );
-	glUniformMatrix3fv( locUniformNM, 1, GL_FALSE, &nm[0][0] );
-        glUniformMatrix4fv( locUniformShadowMatrix, 1, GL_FALSE, &S[0][0] );
-	glUniform3fv(locUniformMaterialAmbient, 1, &(gold.ambient.r));
-	glUniform3fv(locUniformMaterialDiffuse, 1, &(gold.diffuse.r));
-	glUniform3fv(locUniformMaterialSpecular, 1, &(gold.specular.r));
-	glUniform1f(locUniformMaterialShininess, gold.shininess);
-
-	drawSphere();
-
-    S = B * ProjectionLight * ViewLight * ModelTeapot;
-	mvp = Projection * View * ModelTeapot;
-	mv = View * ModelTeapot;
-	nm = glm::mat3(glm::transpose(glm::inverse(mv)));
-	glUniformMatrix4fv( locUniformMVPM, 1, GL_FALSE, &mvp[0][0] );
-	glUniformMatrix4fv( locUniformMVM, 1, GL_FALSE, &mv[0][0] );
-	glUniformMatrix3fv( locUniformNM, 1, GL_FALSE, &nm[0][0] );
-    glUniformMatrix4fv(locUniformShadowMatrix, 1, GL_FALSE, &S[0][0]);
-	glUniform3fv(locUniformMaterialAmbient, 1, &(brass.ambient.r));
-	glUniform3fv(locUniformMaterialDiffuse, 1, &(brass.diffuse.r));
-	glUniform3fv(locUniformMaterialSpecular, 1, &(brass.specular.r));
-	glUniform1f(locUniformMaterialShininess, brass.shininess);
-
-	drawTeapot();
-
-    S = B * ProjectionLight * ViewLight * ModelTorus;
-	mvp = Projection * View * ModelTorus;
-	mv = View * ModelTorus;
-	nm = glm::mat3(glm::transpose(glm::inverse(mv)));
-	glUniformMatrix4fv( locUniformMVPM, 1, GL_FALSE, &mvp[0][0] );
-	glUniformMatrix4fv( locUniformMVM, 1, GL_FALSE, &mv[0][0] );
-	glUniformMatrix3fv( locUniformNM, 1, GL_FALSE, &nm[0][0] );
-        glUniformMatrix4fv(locUniformShadowMatrix, 1, GL_FALSE, &S[0][0]);
-	glUniform3fv(locUniformMaterialAmbient, 1, &(emerald.ambient.r));
-	glUniform3fv(locUniformMaterialDiffuse, 1, &(emerald.diffuse.r));
-	glUniform3fv(locUniformMaterialSpecular, 1, &(emerald.specular.r));
-	glUniform1f(locUniformMaterialShininess, emerald.shininess);
-
-	drawTorus();
-
-    S = B * ProjectionLight * ViewLight * ModelPlane;
-	mvp = Projection * View * ModelPlane;
-	mv = View * ModelPlane;
-	nm = glm::mat3(glm::transpose(glm::inverse(mv)));
-	glUniformMatrix4fv( locUniformMVPM, 1, GL_FALSE, &mvp[0][0] );
-	glUniformMatrix4fv( locUniformMVM, 1, GL_FALSE, &mv[0][0] );
-	glUniformMatrix3fv( locUniformNM, 1, GL_FALSE, &nm[0][0] );
-        glUniformMatrix4fv(locUniformShadowMatrix, 1, GL_FALSE, &S[0][0]);
-	glUniform3fv(locUniformMaterialAmbient, 1, &(perl.ambient.r));
-	glUniform3fv(locUniformMaterialDiffuse, 1, &(perl.diffuse.r));
-	glUniform3fv(locUniformMaterialSpecular, 1, &(perl.specular.r));
-	glUniform1f(locUniformMaterialShininess, perl.shininess);
-
-	drawPlane();
+
+	profileEnd(TIME_CULLING);
+
+	// Cascades split the camera frustum up to shadowDistance and crop the
+	// light frustum to their slice. The crops are kept while their slices
+	// stay inside, so the map is only drawn again when one has to move.
+	profileBegin(TIME_DRAW_LISTS);
+	static CascadeCrop crops[MAX_CASCADES];
+	ShadowCascade cascades[MAX_CASCADES];
+	float splits[MAX_CASCADES];
+	glm::mat4 invView = glm::inverse(View);
+	cascadeSplits(nearPlane, shadowDistance, cascadeCount, cascadeLambda, splits);
+	for (int i = 0; i < cascadeCount; i++)
+	{
+		if (refitLight)
+			crops[i].valid = false;
+		if (cascadeCount > 1)
+			cascadeCropUpdate(crops[i], ProjectionLight * ViewLight, invView, fovy, aspect,
+			                  i ? splits[i - 1] : nearPlane, splits[i], cascadePadding);
+		cascades[i].split = splits[i];
+		cascades[i].crop = (cascadeCount == 1) ? glm::mat4(1.0f) : crops[i].crop;
+	}
+
+	// Commands and per-draw data of both passes, written to the ring once per
+	// frame. Within each cascade, shadow casters are sorted by cull face so
+	// each face is one call.
+	static DrawList shadowDraws, draws;
+	shadowDraws.count = draws.count = 0;
+	shadowCullStats.tested = shadowCullStats.drawn = 0;
+	for (int k = 0; k < cascadeCount; k++)
+	{
+		ShadowCascade &cascade = cascades[k];
+		glm::mat4 cascadeViewProj = cascade.crop * ProjectionLight * ViewLight;
+
+		// Each cascade draws the casters inside its own cropped frustum, all
+		// of them rather than those fitted, which change with the camera
+		glm::vec4 cascadePlanes[6];
+		frustumPlanes(cascadeViewProj, cascadePlanes);
+		cullSpheres(cascadePlanes, 6, boundsX, boundsY, boundsZ, boundsR, scene.count, inCascade.data());
+		for (int i = 0; i < scene.count; i++)
+		{
+			inCascade[i] = inCascade[i] && caster[i];
+			shadowCullStats.tested += caster[i];
+			shadowCullStats.drawn += inCascade[i];
+		}
+
+		// Cropping magnifies the map, and so the error of each level
+		PassMatrices shadowPass;
+		shadowPass.view = ViewLight;
+		shadowPass.projection = cascade.crop * ProjectionLight;
+		shadowPass.shading = false;
+		shadowPass.lodScale = shadowLodScale * std::max(cascade.crop[0][0], cascade.crop[1][1]);
+		shadowPass.maxPixels = shadowLodPixelError;
+		cascade.firstDraw = shadowDraws.count;
+		for (int pass = 0; pass < 2; pass++)
+		{
+			GLenum cullFace = pass == 0 ? GL_BACK : GL_FRONT;
+			if (pass == 1)
+				cascade.frontFaceDraw = shadowDraws.count;
+			int nobjects = 0;
+			for (int i = 0; i < scene.count; i++)
+				if (inCascade[i] && scene.shadowCullFace[i] == cullFace)
+					objects[nobjects++] = i;
+			appendDraws(shadowDraws, objects.data(), nobjects, shadowPass);
+		}
+		cascade.endDraw = shadowDraws.count;
+	}
+
+	PassMatrices cameraPass;
+	cameraPass.view = View;
+	cameraPass.projection = Projection;
+	cameraPass.shading = true;
+	cameraPass.lightViewProj = ProjectionLight * ViewLight;
+	cameraPass.lodScale = lodScale;
+	cameraPass.maxPixels = lodPixelError;
+	int nobjects = 0;
+	for (int i = 0; i < scene.count; i++)
+		if (cameraVisible[i])
+			objects[nobjects++] = i;
+	appendDraws(draws, objects.data(), nobjects, cameraPass);
+
+	// Frames where nothing the map depends on changed reuse the last one
+	unsigned long long signature = shadowSignature(shadowDraws, cascades, cascadeCount);
+	bool drawShadowMap = !shadowMapValid || signature != shadowMapSignature;
+
+	GLsizeiptr sizes[4] = {
+		drawShadowMap ? shadowDraws.count * (GLsizeiptr)sizeof(DrawData) : 0,
+		drawShadowMap ? shadowDraws.count * (GLsizeiptr)sizeof(DrawCommand) : 0,
+		draws.count * (GLsizeiptr)sizeof(DrawData),
+		draws.count * (GLsizeiptr)sizeof(DrawCommand)
+	};
+	uniformRingReserve(uniformRing, uniformRingFrameSize(uniformRing, sizes, 4));
+	uniformRingBeginFrame(uniformRing);
+	if (drawShadowMap)
+	{
+		shadowDraws.dataOffset = uniformRingWrite(uniformRing, shadowDraws.data.data(), sizes[0]);
+		shadowDraws.commandOffset = uniformRingWrite(uniformRing, shadowDraws.commands.data(), sizes[1]);
+	}
+	draws.dataOffset = uniformRingWrite(uniformRing, draws.data.data(), sizes[2]);
+	draws.commandOffset = uniformRingWrite(uniformRing, draws.commands.data(), sizes[3]);
+	uniformRingEndFrame(uniformRing);
+	profileEnd(TIME_DRAW_LISTS);
+
+	if (drawShadowMap)
+	{
+		drawFBO(shadowDraws, cascades, cascadeCount);
+		shadowMapValid = true;
+		shadowMapSignature = signature;
+	}
+
+	profileBegin(TIME_SHADING);
+	glUseProgram(currentProgram->id);
+
+	glm::vec4 lpos = View * light.lightPos;
+	glUniform4fv(currentProgram->locLightPos, 1, &(lpos.x));
+	glUniform3fv(currentProgram->locLightIntensity, 1, &(light.intensity.r));
+
+	// Cascade matrices take light clip space to shadow map coordinates
+	glm::mat4 cascadeMatrices[MAX_CASCADES];
+	glm::vec4 cascadeFar(1e30f);
+	for (int i = 0; i < cascadeCount; i++)
+	{
+		cascadeMatrices[i] = B * cascades[i].crop;
+		cascadeFar[i] = cascades[i].split;
+	}
+	glUniformMatrix4fv(currentProgram->locCascadeMatrices, MAX_CASCADES, GL_FALSE, &cascadeMatrices[0][0][0]);
+	glUniform4fv(currentProgram->locCascadeSplits, 1, &cascadeFar[0]);
+	glUniform1i(currentProgram->locCascadeCount, cascadeCount);
+
+	submitDraws(*currentProgram, draws, 0, draws.count);
+	uniformRingFence(uniformRing);
 
 	glUseProgram(0);
+	profileEnd(TIME_SHADING);
 
-	glutSwapBuffers();
+	if (!headlessFrames)
+	{
+		profileBegin(TIME_SWAP);
+		glutSwapBuffers();
+		profileEnd(TIME_SWAP);
+	}
+	profileEnd(TIME_FRAME);
+
+	if (showTimings)
+		showTimingsHud();
+}
+
+// Section names as the HUD and the exported files show them
+void initTimings()
+{
+	static const char *names[TIME_SECTIONS] = { "frame", "uploads", "scene and culling", "draw lists",
+	                                            "shadow map", "shadow blur", "shading", "swap" };
+	profileInit(PCF_MODES);
+	for (int i = 0; i < TIME_SECTIONS; i++)
+		profileAddSection(names[i], i == TIME_SHADOW_MAP || i == TIME_SHADOW_BLUR || i == TIME_SHADING);
+	profileCapture(!timingsName.empty());
+}
+
+// Once a second, the tables of every pcf mode on stdout and this mode's
+// shadow map and shading costs in the window title
+void showTimingsHud()
+{
+	static int lastShown = 0;
+	int now = elapsedMs();
+	if (now - lastShown < 1000)
+		return;
+	lastShown = now;
+
+	profileReport(pcfModeNames);
+	if (!headlessFrames)
+	{
+		ProfileStats shadowMap, shading;
+		profileGpuStats(pcf, TIME_SHADOW_MAP, shadowMap);
+		profileGpuStats(pcf, TIME_SHADING, shading);
+		char title[128];
+		snprintf(title, sizeof(title), "%s: shadow map %.2f ms, shading %.2f ms (GPU)",
+		         pcfModeNames[pcf], shadowMap.avg, shading.avg);
+		glutSetWindowTitle(title);
+	}
+}
+
+void writeTimings()
+{
+	if (timingsName.empty())
+		return;
+	profileFlush();
+	if (profileWriteCsv(timingsName + ".csv") && profileWriteTrace(timingsName + ".json"))
+		std::cout << "Timings written to " << timingsName << ".csv and " << timingsName << ".json" << std::endl;
+	else
+		std::cerr << "Cannot write the timings to " << timingsName << std::endl;
 }
  
 void resize(int w, int h)
@@ -770,13 +2174,31 @@ void resize(int w, int h)
 }
  
 void idle()
+{
+	animate();
+	glutPostRedisplay();
+}
+
+// Camera and lid motion of one frame
+void animate()
 {
 	if (!mouseDown && animation)
 	{
 		xrot += 0.3f;
 		yrot += 0.4f;
 	}
-	glutPostRedisplay();
+	if (lidOpening && lidOpen < 1.0f)
+		lidOpen = std::min(lidOpen + 0.01f, 1.0f);
+	else if (!lidOpening && lidOpen > 0.0f)
+		lidOpen = std::max(lidOpen - 0.01f, 0.0f);
+}
+
+// Milliseconds since the first call, without GLUT, which headless runs
+// never initialize
+int elapsedMs()
+{
+	static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
 }
  
 void keyboard(unsigned char key, int x, int y)
@@ -784,11 +2206,29 @@ void keyboard(unsigned char key, int x, int y)
 	switch(key)
 	{
 	case 27 : case 'q': case 'Q':
+		writeTimings();
+		loaderStop();
+		jobsShutdown();
 		exit(1); 
 		break;
 	case 'a': case 'A':
 		animation = !animation;
 		break;
+	case 'l': case 'L':
+		lidOpening = !lidOpening;
+		break;
+	case 'p': case 'P':
+		lightAnimation = !lightAnimation;
+		break;
+	case 'h': case 'H':
+		showTimings = !showTimings;
+		break;
+	case 'c': case 'C':
+		std::cout << "Camera pass: " << cameraCullStats.drawn << " drawn, "
+		          << cameraCullStats.tested - cameraCullStats.drawn << " culled; shadow pass: "
+		          << shadowCullStats.drawn << " drawn, "
+		          << shadowCullStats.tested - shadowCullStats.drawn << " culled" << std::endl;
+		break;
 	case '1':
 		//texture_id = TEXTURE_ID_METAL;
 		break;
@@ -796,7 +2236,10 @@ void keyboard(unsigned char key, int x, int y)
 		//texture_id = TEXTURE_ID_STONE;
 		break;
         case '+':
-                pcf = (pcf == 2) ? 0 : pcf + 1;
+                pcf = (pcf + 1) % PCF_MODES;
+                currentProgram = &mainPrograms[pcf];
+                // Only the variance mode keeps the moments up to date
+                shadowMapValid = false;
                 break;
 	}
 }
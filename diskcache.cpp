@@ -0,0 +1,118 @@
+#include "diskcache.h"
+
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+std::string cacheDirectory = "cache";
+
+unsigned long long hashBytes(const void *data, size_t size, unsigned long long seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    unsigned long long h = seed;
+    for( size_t i = 0; i < size; i++ )
+    {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+std::string cachePath(const char *prefix, unsigned long long key, const char *extension)
+{
+    std::ostringstream path;
+    path << cacheDirectory << "/" << prefix << "-" << std::hex << std::setw(16)
+         << std::setfill('0') << key << extension;
+    return path.str();
+}
+
+bool mapFile(const std::string &path, MappedFile &file)
+{
+    file.data = NULL;
+    file.size = 0;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if( fd < 0 )
+        return false;
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 || st.st_size == 0 )
+    {
+        close(fd);
+        return false;
+    }
+
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( p == MAP_FAILED )
+        return false;
+
+    file.data = (const unsigned char *)p;
+    file.size = st.st_size;
+    return true;
+}
+
+void unmapFile(MappedFile &file)
+{
+    if( file.data )
+        munmap((void *)file.data, file.size);
+    file.data = NULL;
+    file.size = 0;
+}
+
+void prefetchFilePages(const MappedFile &file, const void *p, size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const unsigned char *begin = (const unsigned char *)p;
+    madvise((void *)(file.data + ((begin - file.data) & ~(page - 1))),
+            size + ((begin - file.data) & (page - 1)), MADV_WILLNEED);
+
+    // One read per page faults it in
+    volatile unsigned char sink = 0;
+    for( size_t i = 0; i < size; i += page )
+        sink += begin[i];
+    if( size )
+        sink += begin[size - 1];
+    (void)sink;
+}
+
+void releaseFilePages(const MappedFile &file, const void *p, size_t size)
+{
+    // Whole pages only; the mapping itself starts on a page boundary
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t begin = ((const unsigned char *)p - file.data) & ~(page - 1);
+    size_t end = (const unsigned char *)p - file.data + size;
+    if( end > file.size )
+        end = file.size;
+    if( end > begin )
+        madvise((void *)(file.data + begin), end - begin, MADV_DONTNEED);
+}
+
+bool writeFileAtomic(const std::string &path, const void * const *chunks,
+                     const size_t *sizes, int nchunks)
+{
+    mkdir(cacheDirectory.c_str(), 0755);
+
+    std::ostringstream tmp;
+    tmp << path << ".tmp" << getpid();
+
+    FILE *f = fopen(tmp.str().c_str(), "wb");
+    if( !f )
+        return false;
+
+    bool ok = true;
+    for( int i = 0; i < nchunks && ok; i++ )
+        ok = fwrite(chunks[i], 1, sizes[i], f) == sizes[i];
+    ok = (fclose(f) == 0) && ok;
+
+    if( !ok || rename(tmp.str().c_str(), path.c_str()) != 0 )
+    {
+        remove(tmp.str().c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include <cstddef>
+#include <string>
+
+// Helpers shared by the on-disk caches: hashing of cache keys, atomic file
+// writes and read-only memory mapping of cache files.
+
+// Directory holding the cache files, created on first write
+extern std::string cacheDirectory;
+
+// 64-bit FNV-1a; pass the previous result as seed to hash several buffers
+unsigned long long hashBytes(const void *data, size_t size,
+                             unsigned long long seed = 14695981039346656037ULL);
+
+// Path of a cache file named after prefix and the key hash
+std::string cachePath(const char *prefix, unsigned long long key, const char *extension);
+
+struct MappedFile {
+    const unsigned char *data;
+    size_t size;
+};
+
+// Maps a whole file read-only. Returns false if it does not exist or is empty.
+bool mapFile(const std::string &path, MappedFile &file);
+void unmapFile(MappedFile &file);
+
+// Reads the pages of [p, p + size) in the mapping, so a later copy from it
+// does not wait on the disk
+void prefetchFilePages(const MappedFile &file, const void *p, size_t size);
+
+// Drops the resident pages of [p, p + size) in the mapping once they have
+// been read, so streaming through a large file keeps little of it in memory.
+// The data stays readable and is paged in again if touched.
+void releaseFilePages(const MappedFile &file, const void *p, size_t size);
+
+// Writes the chunks to a temporary file and renames it over path, so readers
+// never see a partially written file
+bool writeFileAtomic(const std::string &path, const void * const *chunks,
+                     const size_t *sizes, int nchunks);
+
+#endif // DISKCACHE_H
@@ -0,0 +1,200 @@
+#include "geometryarena.h"
+#include "vertexformat.h"
+
+#include <cstring>
+#include <vector>
+
+// Points the VAO of indices at the vertex buffer and at its index buffer
+static void bindAttributes(GeometryArena &arena, ArenaIndexBuffer &indices)
+{
+    glBindVertexArray(indices.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, arena.vertexBuffer);
+    GLsizei bytes = sizeof(Vertex);
+    glVertexAttribPointer(arena.loc[0], 3, GL_FLOAT, GL_FALSE, bytes, ((GLubyte *)NULL + 0));
+    glEnableVertexAttribArray(arena.loc[0]);
+    glVertexAttribPointer(arena.loc[1], 3, GL_FLOAT, GL_FALSE, bytes, ((GLubyte *)NULL + VERTEX_NORMAL_OFS * sizeof(float)));
+    glEnableVertexAttribArray(arena.loc[1]);
+    glVertexAttribPointer(arena.loc[2], 2, GL_FLOAT, GL_FALSE, bytes, ((GLubyte *)NULL + VERTEX_TEXCOORD_OFS * sizeof(float)));
+    glEnableVertexAttribArray(arena.loc[2]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.buffer);
+    glBindVertexArray(0);
+}
+
+#define PERSISTENT_MAP_FLAGS (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+
+// Replaces buffer with a larger one holding the same first `used` bytes.
+// If mapping is given the new buffer is immutable and persistently mapped
+// there; deleting the old one unmaps it.
+static void growBuffer(GLuint &buffer, GLsizeiptr used, GLsizeiptr size, void **mapping)
+{
+    GLuint bigger;
+    glGenBuffers(1, &bigger);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bigger);
+    if( mapping )
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, PERSISTENT_MAP_FLAGS);
+    else
+        glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+    if( used )
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    if( mapping )
+        *mapping = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, PERSISTENT_MAP_FLAGS);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if( buffer )
+        glDeleteBuffers(1, &buffer);
+    buffer = bigger;
+}
+
+static void initIndices(GeometryArena &arena, ArenaIndexBuffer &indices, GLenum type, int size, int maxIndices)
+{
+    indices.type = type;
+    indices.size = size;
+    indices.maxIndices = maxIndices;
+    indices.nindices = 0;
+    indices.buffer = 0;
+    indices.mapped = NULL;
+    glGenVertexArrays(1, &indices.vao);
+    growBuffer(indices.buffer, 0, (GLsizeiptr)maxIndices * size, arena.persistent ? &indices.mapped : NULL);
+    bindAttributes(arena, indices);
+}
+
+void arenaInit(GeometryArena &arena, int maxVerts, int maxIndices,
+               GLuint locPosition, GLuint locNormal, GLuint locTexCoord, bool persistent)
+{
+    arena.maxVerts = maxVerts;
+    arena.nverts = 0;
+    arena.loc[0] = locPosition;
+    arena.loc[1] = locNormal;
+    arena.loc[2] = locTexCoord;
+    arena.vertexBuffer = 0;
+    arena.persistent = persistent;
+    arena.mappedVerts = NULL;
+
+    growBuffer(arena.vertexBuffer, 0, (GLsizeiptr)maxVerts * sizeof(Vertex),
+               persistent ? (void **)&arena.mappedVerts : NULL);
+    initIndices(arena, arena.indices16, GL_UNSIGNED_SHORT, sizeof(GLushort), maxIndices);
+    initIndices(arena, arena.indices32, GL_UNSIGNED_INT, sizeof(GLuint), maxIndices);
+}
+
+ArenaIndexBuffer &arenaIndices(GeometryArena &arena, GLenum indexType)
+{
+    return indexType == GL_UNSIGNED_SHORT ? arena.indices16 : arena.indices32;
+}
+
+void arenaReserve(GeometryArena &arena, int maxVerts, GLenum indexType, int maxIndices)
+{
+    if( maxVerts > arena.maxVerts )
+    {
+        while( maxVerts > arena.maxVerts )
+            arena.maxVerts *= 2;
+        growBuffer(arena.vertexBuffer, (GLsizeiptr)arena.nverts * sizeof(Vertex), (GLsizeiptr)arena.maxVerts * sizeof(Vertex),
+                   arena.persistent ? (void **)&arena.mappedVerts : NULL);
+        bindAttributes(arena, arena.indices16);
+        bindAttributes(arena, arena.indices32);
+    }
+    ArenaIndexBuffer &indices = arenaIndices(arena, indexType);
+    if( maxIndices > indices.maxIndices )
+    {
+        while( maxIndices > indices.maxIndices )
+            indices.maxIndices *= 2;
+        growBuffer(indices.buffer, (GLsizeiptr)indices.nindices * indices.size, (GLsizeiptr)indices.maxIndices * indices.size,
+                   arena.persistent ? &indices.mapped : NULL);
+        bindAttributes(arena, indices);
+    }
+}
+
+void arenaAllocate(GeometryArena &arena, int nverts, int nelements, GLenum indexType, ArenaMesh &mesh)
+{
+    ArenaIndexBuffer &indices = arenaIndices(arena, indexType);
+    arenaReserve(arena, arena.nverts + nverts, indexType, indices.nindices + nelements);
+    mesh.firstIndex = indices.nindices;
+    mesh.count = nelements;
+    mesh.baseVertex = arena.nverts;
+    mesh.indexType = indexType;
+    arena.nverts += nverts;
+    indices.nindices += nelements;
+}
+
+// The mappings are coherent, so draws issued after the copy see the data
+void arenaWriteVertices(GeometryArena &arena, const ArenaMesh &mesh, int first, const Vertex *verts, int count)
+{
+    if( arena.persistent )
+    {
+        memcpy(arena.mappedVerts + mesh.baseVertex + first, verts, (size_t)count * sizeof(Vertex));
+        return;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena.vertexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)(mesh.baseVertex + first) * sizeof(Vertex),
+                    (GLsizeiptr)count * sizeof(Vertex), verts);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+static void writeIndices(GeometryArena &arena, const ArenaMesh &mesh, int first, const void *el, int count)
+{
+    ArenaIndexBuffer &indices = arenaIndices(arena, mesh.indexType);
+    GLintptr offset = (GLintptr)(mesh.firstIndex + first) * indices.size;
+    if( arena.persistent )
+    {
+        memcpy((unsigned char *)indices.mapped + offset, el, (size_t)count * indices.size);
+        return;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indices.buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, (GLsizeiptr)count * indices.size, el);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// Written as given when the widths match, converted otherwise
+void arenaWriteIndices(GeometryArena &arena, const ArenaMesh &mesh, int first, const GLushort *el, int count)
+{
+    if( mesh.indexType == GL_UNSIGNED_SHORT )
+        writeIndices(arena, mesh, first, el, count);
+    else
+    {
+        std::vector<GLuint> wide(el, el + count);
+        writeIndices(arena, mesh, first, wide.data(), count);
+    }
+}
+
+// A 16-bit mesh has at most 65536 vertices, so its indices fit narrowed
+void arenaWriteIndices(GeometryArena &arena, const ArenaMesh &mesh, int first, const GLuint *el, int count)
+{
+    if( mesh.indexType == GL_UNSIGNED_INT )
+        writeIndices(arena, mesh, first, el, count);
+    else
+    {
+        std::vector<GLushort> narrow(el, el + count);
+        writeIndices(arena, mesh, first, narrow.data(), count);
+    }
+}
+
+void arenaAdd(GeometryArena &arena, const float *v, const float *n, const float *tc, int nverts, int stride,
+              const void *el, int nelements, int indexSize, ArenaMesh &mesh)
+{
+    arenaAllocate(arena, nverts, nelements, indexSize == sizeof(GLuint) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT, mesh);
+
+    // Vertices go in interleaved, planar meshes are interleaved on the way
+    if( stride == VERTEX_FLOATS )
+        arenaWriteVertices(arena, mesh, 0, (const Vertex *)v, nverts);
+    else
+    {
+        std::vector<Vertex> verts(nverts);
+        for( int i = 0; i < nverts; i++ )
+        {
+            for( int k = 0; k < 3; k++ ) {
+                verts[i].position[k] = v[i * 3 + k];
+                verts[i].normal[k] = n[i * 3 + k];
+            }
+            verts[i].texCoord[0] = tc[i * 2];
+            verts[i].texCoord[1] = tc[i * 2 + 1];
+        }
+        arenaWriteVertices(arena, mesh, 0, &verts[0], nverts);
+    }
+
+    if( indexSize == sizeof(GLuint) )
+        arenaWriteIndices(arena, mesh, 0, (const GLuint *)el, nelements);
+    else
+        arenaWriteIndices(arena, mesh, 0, (const GLushort *)el, nelements);
+}
@@ -0,0 +1,64 @@
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+
+#include <GL/glew.h>
+#include "vertexformat.h"
+
+// Every mesh sub-allocated from one shared vertex buffer (interleaved Vertex
+// layout) and one index buffer per index width, 16 and 32-bit, each behind
+// its own VAO over the vertex buffer. Meshes keep their own 0-based indices
+// and are drawn with their base vertex, so the meshes of a pass with the
+// same index width go out in one glMultiDrawElementsIndirect call.
+// With persistent set the buffers are immutable storage mapped for writing
+// for as long as they live, and mesh data is copied straight into them.
+
+struct ArenaMesh {
+    GLuint firstIndex;          // in the index buffer of its width
+    GLuint count;
+    GLint baseVertex;
+    GLenum indexType;           // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+};
+
+struct ArenaIndexBuffer {
+    GLuint vao;
+    GLuint buffer;
+    GLenum type;
+    int size;                   // bytes per index
+    int maxIndices, nindices;
+    void *mapped;               // the mapping of a persistent buffer
+};
+
+struct GeometryArena {
+    GLuint vertexBuffer;
+    int maxVerts, nverts;       // capacity, the buffers double when full
+    ArenaIndexBuffer indices16, indices32;
+    GLuint loc[3];              // position, normal and texcoord attributes
+    bool persistent;
+    Vertex *mappedVerts;
+};
+
+void arenaInit(GeometryArena &arena, int maxVerts, int maxIndices,
+               GLuint locPosition, GLuint locNormal, GLuint locTexCoord, bool persistent);
+
+// The index buffer, and VAO, of meshes with indexType
+ArenaIndexBuffer &arenaIndices(GeometryArena &arena, GLenum indexType);
+
+// Grows the buffers to hold at least maxVerts vertices and maxIndices
+// indices of indexType in all
+void arenaReserve(GeometryArena &arena, int maxVerts, GLenum indexType, int maxIndices);
+
+// Sub-allocates a mesh whose data is then written with arenaWriteVertices
+// and arenaWriteIndices, in as many pieces as the caller likes. Indices are
+// converted to the mesh's width if given in the other; a 16-bit mesh must
+// have at most 65536 vertices.
+void arenaAllocate(GeometryArena &arena, int nverts, int nelements, GLenum indexType, ArenaMesh &mesh);
+void arenaWriteVertices(GeometryArena &arena, const ArenaMesh &mesh, int first, const Vertex *verts, int count);
+void arenaWriteIndices(GeometryArena &arena, const ArenaMesh &mesh, int first, const GLushort *el, int count);
+void arenaWriteIndices(GeometryArena &arena, const ArenaMesh &mesh, int first, const GLuint *el, int count);
+
+// Appends a mesh in either vertex layout (stride 0: separate arrays) with
+// 16 or 32-bit indices, which it keeps
+void arenaAdd(GeometryArena &arena, const float *v, const float *n, const float *tc, int nverts, int stride,
+              const void *el, int nelements, int indexSize, ArenaMesh &mesh);
+
+#endif // GEOMETRYARENA_H
@@ -0,0 +1,159 @@
+#include "imagefile.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// Largest stored deflate block
+#define DEFLATE_BLOCK 65535
+
+unsigned int crcTable[256];
+
+unsigned int crc32(const unsigned char *p, size_t size, unsigned int crc = 0)
+{
+    if( !crcTable[1] )
+    {
+        for( unsigned int n = 0; n < 256; n++ )
+        {
+            unsigned int c = n;
+            for( int k = 0; k < 8; k++ )
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            crcTable[n] = c;
+        }
+    }
+    crc = ~crc;
+    for( size_t i = 0; i < size; i++ )
+        crc = crcTable[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void putBigEndian(std::vector<unsigned char> &out, unsigned int v)
+{
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+bool writeChunk(FILE *f, const char *type, const std::vector<unsigned char> &data)
+{
+    std::vector<unsigned char> header;
+    putBigEndian(header, (unsigned int)data.size());
+    header.insert(header.end(), type, type + 4);
+    unsigned int crc = crc32(&header[4], 4);
+    crc = data.empty() ? crc : crc32(&data[0], data.size(), crc);
+    std::vector<unsigned char> trailer;
+    putBigEndian(trailer, crc);
+
+    return fwrite(&header[0], 1, header.size(), f) == header.size() &&
+           (data.empty() || fwrite(&data[0], 1, data.size(), f) == data.size()) &&
+           fwrite(&trailer[0], 1, trailer.size(), f) == trailer.size();
+}
+
+// RGBA at 8 bits, each row after a "none" filter byte, in a zlib stream of
+// stored blocks
+bool writePng(FILE *f, const unsigned char *pixels, int width, int height)
+{
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    if( fwrite(signature, 1, 8, f) != 8 )
+        return false;
+
+    std::vector<unsigned char> ihdr;
+    putBigEndian(ihdr, width);
+    putBigEndian(ihdr, height);
+    const unsigned char format[5] = { 8, 6, 0, 0, 0 };     // depth, RGBA, deflate, filter, no interlace
+    ihdr.insert(ihdr.end(), format, format + 5);
+    if( !writeChunk(f, "IHDR", ihdr) )
+        return false;
+
+    size_t rowSize = (size_t)width * 4;
+    std::vector<unsigned char> raw;
+    raw.reserve((rowSize + 1) * height);
+    for( int y = height - 1; y >= 0; y-- )
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels + y * rowSize, pixels + (y + 1) * rowSize);
+    }
+
+    std::vector<unsigned char> idat;
+    idat.reserve(raw.size() + raw.size() / DEFLATE_BLOCK * 5 + 11);
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+    size_t offset = 0;
+    do
+    {
+        size_t size = std::min(raw.size() - offset, (size_t)DEFLATE_BLOCK);
+        idat.push_back(offset + size == raw.size() ? 1 : 0);
+        idat.push_back((unsigned char)size);
+        idat.push_back((unsigned char)(size >> 8));
+        idat.push_back((unsigned char)~size);
+        idat.push_back((unsigned char)(~size >> 8));
+        idat.insert(idat.end(), raw.begin() + offset, raw.begin() + offset + size);
+        offset += size;
+    } while( offset < raw.size() );
+
+    unsigned int a = 1, b = 0;
+    for( size_t i = 0; i < raw.size(); i++ )
+    {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    putBigEndian(idat, (b << 16) | a);
+
+    return writeChunk(f, "IDAT", idat) && writeChunk(f, "IEND", std::vector<unsigned char>());
+}
+
+}
+
+ImageFormat imageFormatOf(const std::string &path)
+{
+    size_t dot = path.rfind('.');
+    std::string ext = (dot == std::string::npos) ? "" : path.substr(dot);
+    if( ext == ".ppm" )
+        return IMAGE_PPM;
+    if( ext == ".png" )
+        return IMAGE_PNG;
+    return IMAGE_RAW;
+}
+
+bool writeImage(FILE *f, ImageFormat format, const unsigned char *pixels, int width, int height)
+{
+    if( format == IMAGE_PNG )
+        return writePng(f, pixels, width, height);
+
+    size_t rowSize = (size_t)width * 4;
+    if( format == IMAGE_RAW )
+    {
+        for( int y = height - 1; y >= 0; y-- )
+            if( fwrite(pixels + y * rowSize, 1, rowSize, f) != rowSize )
+                return false;
+        return true;
+    }
+
+    if( fprintf(f, "P6\n%d %d\n255\n", width, height) < 0 )
+        return false;
+    std::vector<unsigned char> row(width * 3);
+    for( int y = height - 1; y >= 0; y-- )
+    {
+        const unsigned char *p = pixels + y * rowSize;
+        for( int x = 0; x < width; x++ )
+        {
+            row[3 * x] = p[4 * x];
+            row[3 * x + 1] = p[4 * x + 1];
+            row[3 * x + 2] = p[4 * x + 2];
+        }
+        if( fwrite(&row[0], 1, row.size(), f) != row.size() )
+            return false;
+    }
+    return true;
+}
+
+bool writeImageFile(const std::string &path, const unsigned char *pixels, int width, int height)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if( !f )
+        return false;
+    bool ok = writeImage(f, imageFormatOf(path), pixels, width, height);
+    return fclose(f) == 0 && ok;
+}
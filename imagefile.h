@@ -0,0 +1,26 @@
+#ifndef IMAGEFILE_H
+#define IMAGEFILE_H
+
+#include <cstdio>
+#include <string>
+
+// Writers for the frames of the headless mode. Pixels are RGBA8 with rows
+// from bottom to top, as glReadPixels returns them; files get them top to
+// bottom. PPM drops the alpha channel and PNG is written uncompressed, so
+// neither needs a library.
+
+enum ImageFormat {
+    IMAGE_PPM,          // binary P6
+    IMAGE_PNG,
+    IMAGE_RAW           // bare RGBA rows, for piping into a video encoder
+};
+
+// From the extension: .ppm, .png, raw for anything else
+ImageFormat imageFormatOf(const std::string &path);
+
+// Writes one image at the current position of f, so a stream of frames can
+// go to a single file. Returns false on a write error.
+bool writeImage(FILE *f, ImageFormat format, const unsigned char *pixels, int width, int height);
+bool writeImageFile(const std::string &path, const unsigned char *pixels, int width, int height);
+
+#endif // IMAGEFILE_H
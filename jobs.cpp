@@ -0,0 +1,153 @@
+#include "jobs.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Batch {
+    const std::function<void(int, int)> *fn;
+    int count;
+    int chunk;
+    std::atomic<int> next;
+    std::atomic<int> pending;   // chunks not finished yet
+};
+
+std::vector<std::thread> workers;
+std::mutex poolMutex;            // guards batch/generation/quit
+std::condition_variable wakeCond;
+std::condition_variable doneCond;
+std::mutex submitMutex;          // one parallelFor in flight at a time
+Batch *batch = NULL;
+unsigned long generation = 0;
+int activeWorkers = 0;           // workers still holding a pointer to batch
+bool quit = false;
+thread_local bool insideJob = false;
+
+// Pulls chunks from the batch until none are left
+void runChunks(Batch *b)
+{
+    int nchunks = (b->count + b->chunk - 1) / b->chunk;
+    for( ;; )
+    {
+        int c = b->next.fetch_add(1);
+        if( c >= nchunks )
+            break;
+        int begin = c * b->chunk;
+        int end = begin + b->chunk < b->count ? begin + b->chunk : b->count;
+        (*b->fn)(begin, end);
+        if( b->pending.fetch_sub(1) == 1 )
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            doneCond.notify_all();
+        }
+    }
+}
+
+void workerMain()
+{
+    insideJob = true;
+    unsigned long seen = 0;
+    for( ;; )
+    {
+        Batch *b;
+        {
+            std::unique_lock<std::mutex> lock(poolMutex);
+            wakeCond.wait(lock, [&]{ return quit || (batch != NULL && generation != seen); });
+            if( quit )
+                return;
+            seen = generation;
+            b = batch;
+            activeWorkers++;
+        }
+        runChunks(b);
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            activeWorkers--;
+        }
+        doneCond.notify_all();
+    }
+}
+
+}
+
+void jobsInit(int nthreads)
+{
+    std::lock_guard<std::mutex> submit(submitMutex);
+    if( !workers.empty() )
+        return;
+
+    if( nthreads <= 0 )
+        nthreads = (int)std::thread::hardware_concurrency();
+    // The submitting thread works too, so it counts as one of the threads
+    for( int i = 1; i < nthreads; i++ )
+        workers.push_back(std::thread(workerMain));
+}
+
+void jobsShutdown()
+{
+    std::lock_guard<std::mutex> submit(submitMutex);
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        quit = true;
+    }
+    wakeCond.notify_all();
+    for( size_t i = 0; i < workers.size(); i++ )
+        workers[i].join();
+    workers.clear();
+    quit = false;
+}
+
+int jobsThreadCount()
+{
+    return (int)workers.size() + 1;
+}
+
+void parallelFor(int count, int chunk, const std::function<void(int, int)> &fn)
+{
+    if( count <= 0 )
+        return;
+    if( chunk <= 0 )
+        chunk = 1;
+
+    if( insideJob || count <= chunk )
+    {
+        fn(0, count);
+        return;
+    }
+
+    if( workers.empty() )
+        jobsInit(0);
+    if( workers.empty() )
+    {
+        fn(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(submitMutex);
+
+    Batch b;
+    b.fn = &fn;
+    b.count = count;
+    b.chunk = chunk;
+    b.next = 0;
+    b.pending = (count + chunk - 1) / chunk;
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        batch = &b;
+        generation++;
+    }
+    wakeCond.notify_all();
+
+    insideJob = true;
+    runChunks(&b);
+    insideJob = false;
+
+    std::unique_lock<std::mutex> lock(poolMutex);
+    doneCond.wait(lock, [&]{ return b.pending.load() == 0 && activeWorkers == 0; });
+    batch = NULL;
+}
@@ -0,0 +1,18 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <functional>
+
+// Minimal persistent thread pool used to fan CPU work out across cores.
+// Workers are started lazily on the first parallelFor call.
+
+void jobsInit(int nthreads);   // 0 = one worker per hardware thread
+void jobsShutdown();
+int jobsThreadCount();
+
+// Calls fn(begin, end) over [0, count) in chunks of at most `chunk` items.
+// The calling thread takes part and the call returns once every chunk is done.
+// Calls made from inside a job run serially on the calling worker.
+void parallelFor(int count, int chunk, const std::function<void(int, int)> &fn);
+
+#endif // JOBS_H
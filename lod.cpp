@@ -0,0 +1,27 @@
+#include "lod.h"
+#include <cmath>
+
+float chordError(float radius, float angle)
+{
+    return radius * (1.0f - cos(angle * 0.5f));
+}
+
+float lodProjectionScale(float fovy, int viewportHeight)
+{
+    float halfAngle = fovy * 0.5f * 3.14159265358979323846f / 180.0f;
+    return viewportHeight / (2.0f * tan(halfAngle));
+}
+
+int selectLod(const float *errors, int nlevels, float scale, float distance,
+              float projectionScale, float maxPixels)
+{
+    // Too close to tell, keep the finest level
+    if( distance <= 0.0f )
+        return 0;
+
+    float pixelsPerUnit = scale * projectionScale / distance;
+    for( int i = nlevels - 1; i > 0; i-- )
+        if( errors[i] * pixelsPerUnit <= maxPixels )
+            return i;
+    return 0;
+}
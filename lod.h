@@ -0,0 +1,23 @@
+#ifndef LOD_H
+#define LOD_H
+
+// Level of detail selection from projected screen-space error.
+// A LOD chain lists the geometric error of each level in object space,
+// finest level first.
+
+#define MAX_LODS 4
+
+// Distance between a circular arc of this radius and the chord spanning
+// angle radians, the error of sampling a curved surface at that step
+float chordError(float radius, float angle);
+
+// Pixels one world unit at distance 1 covers for a perspective projection
+// with this vertical field of view (degrees) and viewport height
+float lodProjectionScale(float fovy, int viewportHeight);
+
+// Coarsest level whose error, scaled to world units by scale and seen from
+// distance, projects to at most maxPixels. Returns 0 when none does.
+int selectLod(const float *errors, int nlevels, float scale, float distance,
+              float projectionScale, float maxPixels);
+
+#endif // LOD_H
@@ -0,0 +1,168 @@
+#include "meshcache.h"
+
+#include <cstring>
+#include "vertexformat.h"
+
+// Bump when the file layout or any generator output changes
+#define MESH_CACHE_VERSION 5
+#define MESH_CACHE_ALIGN 64
+
+struct MeshCacheHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned long long key;
+    unsigned int nverts;
+    unsigned int nelements;
+    unsigned int indexSize;
+    unsigned int stride;
+    unsigned long long offset[4];   // v, n, tc, el from the start of the file
+    float center[3];                // bounding sphere
+    float radius;
+    unsigned int nranges;
+    MeshRange ranges[MESH_MAX_RANGES];
+};
+
+static size_t alignUp(size_t x)
+{
+    return (x + MESH_CACHE_ALIGN - 1) & ~(size_t)(MESH_CACHE_ALIGN - 1);
+}
+
+// Block sizes in file order
+static void blockSizes(unsigned int nverts, unsigned int nelements, unsigned int indexSize,
+                       unsigned int stride, size_t size[4])
+{
+    if( stride ) {
+        size[0] = (size_t)stride * nverts * sizeof(float);
+        size[1] = 0;
+        size[2] = 0;
+    } else {
+        size[0] = 3 * nverts * sizeof(float);
+        size[1] = 3 * nverts * sizeof(float);
+        size[2] = 2 * nverts * sizeof(float);
+    }
+    size[3] = (size_t)nelements * indexSize;
+}
+
+unsigned long long meshCacheKey(const char *generator, const float *params, int nparams)
+{
+    unsigned int version = MESH_CACHE_VERSION;
+    unsigned long long h = hashBytes(&version, sizeof(version));
+    h = hashBytes(generator, strlen(generator), h);
+    return hashBytes(params, nparams * sizeof(float), h);
+}
+
+bool meshCacheLoad(unsigned long long key, CachedMesh &mesh, int nranges)
+{
+    if( !mapFile(cachePath("mesh", key, ".bin"), mesh.file) )
+        return false;
+
+    const MeshCacheHeader *h = (const MeshCacheHeader *)mesh.file.data;
+    bool valid = mesh.file.size >= sizeof(MeshCacheHeader) &&
+                 memcmp(h->magic, "MESH", 4) == 0 &&
+                 h->version == MESH_CACHE_VERSION &&
+                 h->key == key &&
+                 (h->indexSize == 2 || h->indexSize == 4) &&
+                 (h->stride == 0 || h->stride == VERTEX_FLOATS) &&
+                 h->nranges == (unsigned int)nranges && h->nranges <= MESH_MAX_RANGES;
+
+    // Ranges outside the mesh would draw other meshes' data from the arena
+    for( unsigned int i = 0; valid && i < h->nranges; i++ )
+    {
+        const MeshRange &r = h->ranges[i];
+        valid = r.firstVertex >= 0 && r.nverts >= 0 && r.firstElement >= 0 && r.nelements >= 0 &&
+                (unsigned int)r.firstVertex <= h->nverts && (unsigned int)r.nverts <= h->nverts - r.firstVertex &&
+                (unsigned int)r.firstElement <= h->nelements &&
+                (unsigned int)r.nelements <= h->nelements - r.firstElement;
+    }
+
+    if( valid )
+    {
+        size_t size[4];
+        blockSizes(h->nverts, h->nelements, h->indexSize, h->stride, size);
+        for( int i = 0; i < 4 && valid; i++ )
+            valid = h->offset[i] % MESH_CACHE_ALIGN == 0 && h->offset[i] + size[i] <= mesh.file.size;
+    }
+
+    if( !valid )
+    {
+        unmapFile(mesh.file);
+        return false;
+    }
+
+    mesh.nverts = h->nverts;
+    mesh.nelements = h->nelements;
+    mesh.indexSize = h->indexSize;
+    mesh.stride = h->stride;
+    mesh.v = (const float *)(mesh.file.data + h->offset[0]);
+    if( h->stride ) {
+        mesh.n = mesh.v + VERTEX_NORMAL_OFS;
+        mesh.tc = mesh.v + VERTEX_TEXCOORD_OFS;
+    } else {
+        mesh.n = (const float *)(mesh.file.data + h->offset[1]);
+        mesh.tc = (const float *)(mesh.file.data + h->offset[2]);
+    }
+    mesh.el = mesh.file.data + h->offset[3];
+    mesh.bounds.center = glm::vec3(h->center[0], h->center[1], h->center[2]);
+    mesh.bounds.radius = h->radius;
+    mesh.nranges = h->nranges;
+    memcpy(mesh.ranges, h->ranges, h->nranges * sizeof(MeshRange));
+    return true;
+}
+
+void meshCacheRelease(CachedMesh &mesh)
+{
+    unmapFile(mesh.file);
+}
+
+bool meshCacheStore(unsigned long long key, const float *v, const float *n, const float *tc, int nverts, int stride,
+                    const void *el, int nelements, int indexSize, const BoundingSphere &bounds,
+                    const MeshRange *ranges, int nranges)
+{
+    MeshCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "MESH", 4);
+    h.version = MESH_CACHE_VERSION;
+    h.key = key;
+    h.nverts = nverts;
+    h.nelements = nelements;
+    h.indexSize = indexSize;
+    h.stride = stride;
+    h.center[0] = bounds.center.x;
+    h.center[1] = bounds.center.y;
+    h.center[2] = bounds.center.z;
+    h.radius = bounds.radius;
+    h.nranges = nranges < MESH_MAX_RANGES ? nranges : MESH_MAX_RANGES;
+    if( h.nranges )
+        memcpy(h.ranges, ranges, h.nranges * sizeof(MeshRange));
+
+    size_t size[4];
+    blockSizes(nverts, nelements, indexSize, stride, size);
+    size_t offset = alignUp(sizeof(h));
+    for( int i = 0; i < 4; i++ )
+    {
+        h.offset[i] = offset;
+        offset = alignUp(offset + size[i]);
+    }
+
+    // Header, blocks and the zero padding between them
+    static const unsigned char zeros[MESH_CACHE_ALIGN] = { 0 };
+    const void *blocks[4] = { v, n, tc, el };
+    const void *chunks[9];
+    size_t sizes[9];
+    int nchunks = 0;
+    size_t written = 0;
+
+    chunks[nchunks] = &h;
+    sizes[nchunks++] = sizeof(h);
+    written = sizeof(h);
+    for( int i = 0; i < 4; i++ )
+    {
+        chunks[nchunks] = zeros;
+        sizes[nchunks++] = h.offset[i] - written;
+        chunks[nchunks] = blocks[i];
+        sizes[nchunks++] = size[i];
+        written = h.offset[i] + size[i];
+    }
+
+    return writeFileAtomic(cachePath("mesh", key, ".bin"), chunks, sizes, nchunks);
+}
@@ -0,0 +1,42 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include "bounds.h"
+#include "diskcache.h"
+#include "vertexformat.h"
+
+// Binary mesh files keyed by the generator and its parameters. A file holds a
+// versioned header followed by aligned vertex, normal, texcoord and index
+// blocks, so a cached mesh is uploaded straight from the mapping. Interleaved
+// meshes store a single vertex block instead of the three attribute blocks.
+// The header also keeps the mesh's bounding sphere and its named part
+// ranges, if it has any, so loading never reads the vertices.
+
+struct CachedMesh {
+    MappedFile file;
+    int nverts;
+    int nelements;
+    int indexSize;      // bytes per index, 2 or 4
+    int stride;         // floats per interleaved vertex, 0 for separate blocks
+    const float *v;
+    const float *n;
+    const float *tc;
+    const void *el;
+    BoundingSphere bounds;
+    int nranges;
+    MeshRange ranges[MESH_MAX_RANGES];
+};
+
+unsigned long long meshCacheKey(const char *generator, const float *params, int nparams);
+
+// Maps the cached mesh for key, which must have nranges part ranges, all
+// within its vertices and indices. Returns false on a miss or a stale or
+// damaged file, which the caller then generates again.
+bool meshCacheLoad(unsigned long long key, CachedMesh &mesh, int nranges = 0);
+void meshCacheRelease(CachedMesh &mesh);
+
+bool meshCacheStore(unsigned long long key, const float *v, const float *n, const float *tc, int nverts, int stride,
+                    const void *el, int nelements, int indexSize, const BoundingSphere &bounds,
+                    const MeshRange *ranges = 0, int nranges = 0);
+
+#endif // MESHCACHE_H
@@ -0,0 +1,439 @@
+#include "meshopt.h"
+
+#include <cmath>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+// Spatial hash cell of a position, tolerance sized
+static unsigned long long cellKey(int x, int y, int z)
+{
+    return ((unsigned long long)(x & 0x1fffff) << 42) |
+           ((unsigned long long)(y & 0x1fffff) << 21) |
+            (unsigned long long)(z & 0x1fffff);
+}
+
+// Copies vertex src over vertex dst in either layout
+static void copyVertex(float *v, float *n, float *tc, int stride, int dst, int src)
+{
+    if( stride ) {
+        for( int k = 0; k < stride; k++ )
+            v[dst * stride + k] = v[src * stride + k];
+    } else {
+        for( int k = 0; k < 3; k++ ) {
+            v[dst * 3 + k] = v[src * 3 + k];
+            n[dst * 3 + k] = n[src * 3 + k];
+        }
+        tc[dst * 2] = tc[src * 2];
+        tc[dst * 2 + 1] = tc[src * 2 + 1];
+    }
+}
+
+static bool hasNaN(const float *n)
+{
+    return std::isnan(n[0]) || std::isnan(n[1]) || std::isnan(n[2]);
+}
+
+int weldVertices(float *v, float *n, float *tc, int nverts, int stride,
+                 unsigned int *el, int &nelements, float tolerance, float creaseAngle)
+{
+    int vstride = stride ? stride : 3;
+    float inv = 1.0f / tolerance;
+    float tol2 = tolerance * tolerance;
+    float creaseCos = cos(creaseAngle * 3.14159265358979323846f / 180.0f);
+
+    std::unordered_map<unsigned long long, int> head;   // first kept vertex per cell
+    std::vector<int> next(nverts, -1);                  // next kept vertex in the same cell
+    std::vector<int> remap(nverts);
+    head.reserve(nverts);
+
+    int count = 0;
+    for( int i = 0; i < nverts; i++ )
+    {
+        const float *p = v + i * vstride;
+        const float *pn = n + i * vstride;
+        int cx = (int)floor(p[0] * inv), cy = (int)floor(p[1] * inv), cz = (int)floor(p[2] * inv);
+
+        // Look for a kept vertex to merge with in the neighbouring cells
+        int match = -1;
+        for( int dx = -1; dx <= 1 && match < 0; dx++ )
+            for( int dy = -1; dy <= 1 && match < 0; dy++ )
+                for( int dz = -1; dz <= 1 && match < 0; dz++ )
+                {
+                    std::unordered_map<unsigned long long, int>::const_iterator it =
+                        head.find(cellKey(cx + dx, cy + dy, cz + dz));
+                    for( int o = (it == head.end()) ? -1 : it->second; o >= 0; o = next[o] )
+                    {
+                        const float *q = v + o * vstride;
+                        const float *qn = n + o * vstride;
+                        float ex = p[0] - q[0], ey = p[1] - q[1], ez = p[2] - q[2];
+                        if( ex*ex + ey*ey + ez*ez > tol2 )
+                            continue;
+                        if( !hasNaN(pn) && !hasNaN(qn) &&
+                            pn[0]*qn[0] + pn[1]*qn[1] + pn[2]*qn[2] < creaseCos )
+                            continue;
+                        match = o;
+                        break;
+                    }
+                }
+
+        if( match >= 0 )
+        {
+            float *qn = n + match * vstride;
+            if( hasNaN(qn) && !hasNaN(pn) ) {
+                qn[0] = pn[0];
+                qn[1] = pn[1];
+                qn[2] = pn[2];
+            }
+            remap[i] = match;
+            continue;
+        }
+
+        // Keep the vertex, moving it down to the next free slot
+        int o = count++;
+        if( o != i )
+            copyVertex(v, n, tc, stride, o, i);
+        unsigned long long key = cellKey(cx, cy, cz);
+        std::unordered_map<unsigned long long, int>::iterator it = head.find(key);
+        if( it == head.end() )
+            head[key] = o;
+        else {
+            next[o] = it->second;
+            it->second = o;
+        }
+        remap[i] = o;
+    }
+
+    // Remap the triangles and drop the ones that collapsed
+    int out = 0;
+    for( int t = 0; t + 2 < nelements; t += 3 )
+    {
+        unsigned int a = remap[el[t]], b = remap[el[t+1]], c = remap[el[t+2]];
+        if( a == b || b == c || a == c )
+            continue;
+        el[out] = a;
+        el[out+1] = b;
+        el[out+2] = c;
+        out += 3;
+    }
+    nelements = out;
+
+    return count;
+}
+
+int weldVertexRanges(float *v, float *n, float *tc, int stride, unsigned int *el, int &nelements,
+                     MeshRange *ranges, int nranges, float tolerance, float creaseAngle)
+{
+    int vstride = stride ? stride : 3;
+    int tstride = stride ? stride : 2;
+    int vert = 0, elem = 0;
+
+    for( int r = 0; r < nranges; r++ )
+    {
+        MeshRange &range = ranges[r];
+        unsigned int *rel = el + range.firstElement;
+        int nel = range.nelements;
+
+        // Weld the range on its own, with indices local to it
+        for( int i = 0; i < nel; i++ )
+            rel[i] -= range.firstVertex;
+        int nv = weldVertices(v + range.firstVertex * vstride, n + range.firstVertex * vstride,
+                              tc + range.firstVertex * tstride, range.nverts, stride,
+                              rel, nel, tolerance, creaseAngle);
+
+        // and pack it right after the previous one
+        for( int i = 0; i < nv; i++ )
+            if( vert + i != range.firstVertex + i )
+                copyVertex(v, n, tc, stride, vert + i, range.firstVertex + i);
+        for( int i = 0; i < nel; i++ )
+            el[elem + i] = rel[i] + vert;
+
+        range.firstVertex = vert;
+        range.nverts = nv;
+        range.firstElement = elem;
+        range.nelements = nel;
+        vert += nv;
+        elem += nel;
+    }
+
+    nelements = elem;
+    return vert;
+}
+
+int triangulateQuads(const unsigned short *quads, int nelements, int nverts, unsigned int *tris)
+{
+    int out = 0;
+    for( int q = 0; q + 3 < nelements; q += 4 )
+    {
+        const unsigned short *c = quads + q;
+        if( c[0] >= nverts || c[1] >= nverts || c[2] >= nverts || c[3] >= nverts )
+            continue;
+        tris[out++] = c[0];
+        tris[out++] = c[1];
+        tris[out++] = c[2];
+        tris[out++] = c[0];
+        tris[out++] = c[2];
+        tris[out++] = c[3];
+    }
+    return out;
+}
+
+void packIndices16(const unsigned int *el, int nelements, unsigned short *out)
+{
+    for( int i = 0; i < nelements; i++ )
+        out[i] = (unsigned short)el[i];
+}
+
+// Forsyth's vertex score: vertices recently used score high, and so do
+// vertices with few triangles left so that they get finished off
+static const int maxValence = 64;
+static float cacheScore[VERTEX_CACHE_SIZE + 3];
+static float valenceScore[maxValence];
+
+static void initScores()
+{
+    static bool done = false;
+    if( done )
+        return;
+    done = true;
+    for( int i = 0; i < VERTEX_CACHE_SIZE + 3; i++ )
+    {
+        // The last triangle's vertices get a fixed score so the strip does
+        // not turn straight back onto itself
+        if( i < 3 )
+            cacheScore[i] = 0.75f;
+        else if( i < VERTEX_CACHE_SIZE )
+            cacheScore[i] = pow(1.0f - (i - 3) / (float)(VERTEX_CACHE_SIZE - 3), 1.5f);
+        else
+            cacheScore[i] = 0.0f;
+    }
+    for( int i = 0; i < maxValence; i++ )
+        valenceScore[i] = i ? 2.0f * pow((float)i, -0.5f) : 0.0f;
+}
+
+static float vertexScore(int cachePos, int valence)
+{
+    if( valence == 0 )
+        return -1.0f;
+    float score = cachePos >= 0 ? cacheScore[cachePos] : 0.0f;
+    return score + valenceScore[valence < maxValence ? valence : maxValence - 1];
+}
+
+void optimizeVertexCache(unsigned int *el, int nelements, int nverts)
+{
+    initScores();
+    int ntris = nelements / 3;
+
+    // Triangles using each vertex, as offsets into one adjacency array
+    std::vector<int> valence(nverts, 0), first(nverts + 1, 0);
+    for( int i = 0; i < ntris * 3; i++ )
+        valence[el[i]]++;
+    for( int i = 0; i < nverts; i++ )
+        first[i + 1] = first[i] + valence[i];
+    std::vector<int> adjacency(ntris * 3), fill(first.begin(), first.end() - 1);
+    for( int t = 0; t < ntris; t++ )
+        for( int k = 0; k < 3; k++ )
+            adjacency[fill[el[t * 3 + k]]++] = t;
+
+    std::vector<int> cachePos(nverts, -1);
+    std::vector<float> score(nverts), triScore(ntris);
+    std::vector<bool> emitted(ntris, false);
+    for( int i = 0; i < nverts; i++ )
+        score[i] = vertexScore(-1, valence[i]);
+    for( int t = 0; t < ntris; t++ )
+        triScore[t] = score[el[t * 3]] + score[el[t * 3 + 1]] + score[el[t * 3 + 2]];
+
+    std::vector<unsigned int> out(ntris * 3);
+    int cache[VERTEX_CACHE_SIZE + 3], cacheCount = 0;
+    int best = -1, cursor = 0;
+
+    for( int o = 0; o < ntris; o++ )
+    {
+        // No candidate in the cache: carry on with the next triangle in
+        // input order, which for the generated grids is next to the last one
+        if( best < 0 )
+        {
+            while( emitted[cursor] )
+                cursor++;
+            best = cursor;
+        }
+
+        const unsigned int *tri = el + best * 3;
+        out[o * 3] = tri[0];
+        out[o * 3 + 1] = tri[1];
+        out[o * 3 + 2] = tri[2];
+        emitted[best] = true;
+
+        // Move the triangle's vertices to the front of the LRU cache
+        int newCache[VERTEX_CACHE_SIZE + 3], newCount = 0;
+        for( int k = 0; k < 3; k++ )
+        {
+            newCache[newCount++] = tri[k];
+            // Drop the triangle from its vertices' adjacency
+            int a = first[tri[k]], e = a + valence[tri[k]];
+            for( int j = a; j < e; j++ )
+                if( adjacency[j] == best ) {
+                    adjacency[j] = adjacency[e - 1];
+                    break;
+                }
+            valence[tri[k]]--;
+        }
+        for( int i = 0; i < cacheCount; i++ )
+        {
+            int c = cache[i];
+            if( c != (int)tri[0] && c != (int)tri[1] && c != (int)tri[2] )
+                newCache[newCount++] = c;
+        }
+
+        // Rescore the vertices whose cache position changed and the triangles
+        // around them, picking the best one for the next step
+        best = -1;
+        float bestScore = -1.0f;
+        for( int i = 0; i < newCount; i++ )
+        {
+            int c = newCache[i];
+            cachePos[c] = i < VERTEX_CACHE_SIZE ? i : -1;
+            float ns = vertexScore(cachePos[c], valence[c]);
+            float diff = ns - score[c];
+            score[c] = ns;
+            for( int j = first[c]; j < first[c] + valence[c]; j++ )
+            {
+                int t = adjacency[j];
+                triScore[t] += diff;
+                if( triScore[t] > bestScore ) {
+                    bestScore = triScore[t];
+                    best = t;
+                }
+            }
+        }
+        cacheCount = newCount < VERTEX_CACHE_SIZE ? newCount : VERTEX_CACHE_SIZE;
+        for( int i = 0; i < cacheCount; i++ )
+            cache[i] = newCache[i];
+    }
+
+    for( int i = 0; i < ntris * 3; i++ )
+        el[i] = out[i];
+}
+
+// Cache misses a triangle causes in the FIFO cache, updating it
+static int fifoMisses(const unsigned int *tri, std::vector<int> &stamp, int &time, int cacheSize)
+{
+    int misses = 0;
+    for( int k = 0; k < 3; k++ )
+        if( stamp[tri[k]] < 0 || time - stamp[tri[k]] >= cacheSize )
+        {
+            stamp[tri[k]] = time++;
+            misses++;
+        }
+    return misses;
+}
+
+VertexCacheStats analyzeVertexCache(const unsigned int *el, int nelements, int nverts, int cacheSize)
+{
+    std::vector<int> stamp(nverts, -1);
+    std::vector<bool> used(nverts, false);
+    int time = 0, misses = 0, unique = 0;
+    for( int t = 0; t + 2 < nelements; t += 3 )
+    {
+        misses += fifoMisses(el + t, stamp, time, cacheSize);
+        for( int k = 0; k < 3; k++ )
+            if( !used[el[t + k]] ) {
+                used[el[t + k]] = true;
+                unique++;
+            }
+    }
+
+    VertexCacheStats stats;
+    stats.acmr = nelements ? misses / (float)(nelements / 3) : 0.0f;
+    stats.atvr = unique ? misses / (float)unique : 0.0f;
+    return stats;
+}
+
+void optimizeOverdraw(unsigned int *el, int nelements, const float *v, int nverts,
+                      int stride, float threshold)
+{
+    int vstride = stride ? stride : 3;
+    int ntris = nelements / 3;
+    if( ntris == 0 )
+        return;
+
+    // Cut the triangle sequence into clusters where the cache would have
+    // to restart anyway, or once the cluster's ACMR counting a cold cache
+    // is within threshold of the whole mesh's so that moving it is cheap
+    float meshAcmr = analyzeVertexCache(el, nelements, nverts, VERTEX_CACHE_SIZE).acmr;
+    std::vector<int> clusters;
+    std::vector<int> stamp(nverts, -1);
+    int time = 0, misses = 0, start = 0;
+    for( int t = 0; t < ntris; t++ )
+    {
+        if( t > start && misses / (float)(t - start) <= threshold * meshAcmr )
+        {
+            clusters.push_back(start);
+            start = t;
+            misses = 0;
+            time += VERTEX_CACHE_SIZE;  // cold cache for the new cluster
+        }
+        int m = fifoMisses(el + t * 3, stamp, time, VERTEX_CACHE_SIZE);
+        if( m == 3 && t > start )
+        {
+            clusters.push_back(start);
+            start = t;
+            misses = 0;
+        }
+        misses += m;
+    }
+    clusters.push_back(start);
+    clusters.push_back(ntris);
+
+    // Mesh centroid, from the triangle centers
+    float center[3] = { 0.0f, 0.0f, 0.0f };
+    for( int i = 0; i < ntris * 3; i++ )
+        for( int k = 0; k < 3; k++ )
+            center[k] += v[el[i] * vstride + k];
+    for( int k = 0; k < 3; k++ )
+        center[k] /= ntris * 3;
+
+    // Sort key: how far out along its own facing direction a cluster is
+    int nclusters = (int)clusters.size() - 1;
+    std::vector<std::pair<float, int> > order(nclusters);
+    for( int c = 0; c < nclusters; c++ )
+    {
+        float c0[3] = { 0.0f, 0.0f, 0.0f }, normal[3] = { 0.0f, 0.0f, 0.0f };
+        float area = 0.0f;
+        for( int t = clusters[c]; t < clusters[c + 1]; t++ )
+        {
+            const float *a = v + el[t * 3] * vstride;
+            const float *b = v + el[t * 3 + 1] * vstride;
+            const float *d = v + el[t * 3 + 2] * vstride;
+            float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+            float e2[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+            float nx = e1[1] * e2[2] - e1[2] * e2[1];
+            float ny = e1[2] * e2[0] - e1[0] * e2[2];
+            float nz = e1[0] * e2[1] - e1[1] * e2[0];
+            float w = sqrt(nx * nx + ny * ny + nz * nz);
+            for( int k = 0; k < 3; k++ )
+                c0[k] += (a[k] + b[k] + d[k]) / 3.0f * w;
+            normal[0] += nx;
+            normal[1] += ny;
+            normal[2] += nz;
+            area += w;
+        }
+        float len = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        float key = 0.0f;
+        if( area > 0.0f && len > 0.0f )
+            for( int k = 0; k < 3; k++ )
+                key += (c0[k] / area - center[k]) * normal[k] / len;
+        order[c] = std::make_pair(-key, c);
+    }
+    std::stable_sort(order.begin(), order.end());
+
+    std::vector<unsigned int> out;
+    out.reserve(ntris * 3);
+    for( int c = 0; c < nclusters; c++ )
+    {
+        int cl = order[c].second;
+        out.insert(out.end(), el + clusters[cl] * 3, el + clusters[cl + 1] * 3);
+    }
+    for( int i = 0; i < ntris * 3; i++ )
+        el[i] = out[i];
+}
@@ -0,0 +1,57 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include "vertexformat.h"
+
+// Post-processing of generated index/vertex buffers.
+// v, n and tc follow the generators' convention: stride is the number of
+// floats between consecutive vertices, 0 for separate packed arrays.
+
+// Merges vertices whose positions are within tolerance of each other, unless
+// their normals differ by more than creaseAngle degrees (creased surfaces keep
+// one vertex per side). Texture coordinates of merged vertices are dropped in
+// favour of the first one. NaN normals, found at degenerate patch corners,
+// take the normal of the vertex they merge with.
+// Vertices are compacted in place, el is remapped and triangles that collapse
+// are removed. Returns the new vertex count and updates nelements.
+int weldVertices(float *v, float *n, float *tc, int nverts, int stride,
+                 unsigned int *el, int &nelements, float tolerance, float creaseAngle);
+
+// Welds each range separately, so no vertex ends up shared between two of
+// them, and packs the results back to back. The ranges must cover the mesh in
+// order; they are updated to the packed layout. Returns the new vertex count.
+int weldVertexRanges(float *v, float *n, float *tc, int stride, unsigned int *el, int &nelements,
+                     MeshRange *ranges, int nranges, float tolerance, float creaseAngle);
+
+// Post-transform cache size the optimizer and the statistics assume
+#define VERTEX_CACHE_SIZE 32
+
+// Reorders the triangles of el for the post-transform vertex cache using
+// Forsyth's linear-speed algorithm (LRU cache of VERTEX_CACHE_SIZE entries).
+void optimizeVertexCache(unsigned int *el, int nelements, int nverts);
+
+// Splits a cache-optimized el into clusters whose ACMR stays within threshold
+// times the whole mesh's, and sorts them so the outward-facing clusters on the
+// hull are drawn first and occlude the rest.
+// OVERDRAW_THRESHOLD trades 5% of vertex cache hits for less overdraw.
+#define OVERDRAW_THRESHOLD 1.05f
+void optimizeOverdraw(unsigned int *el, int nelements, const float *v, int nverts,
+                      int stride, float threshold);
+
+// Average cache miss ratio (transformed vertices per triangle) and average
+// transformed vertex ratio (transformed vertices per vertex) of el through a
+// FIFO cache of cacheSize entries. The ideal ATVR is 1.
+struct VertexCacheStats {
+    float acmr;
+    float atvr;
+};
+VertexCacheStats analyzeVertexCache(const unsigned int *el, int nelements, int nverts, int cacheSize);
+
+// Splits a quad list into a triangle list (two per quad, same winding) and
+// returns its index count. Quads referencing a vertex past nverts are dropped.
+int triangulateQuads(const unsigned short *quads, int nelements, int nverts, unsigned int *tris);
+
+// Copies el into 16-bit indices. Only valid when every index fits.
+void packIndices16(const unsigned int *el, int nelements, unsigned short *out);
+
+#endif // MESHOPT_H
@@ -0,0 +1,85 @@
+// Converts a Wavefront OBJ file to the binary scene format the demo loads
+// with -scene:
+//     ./objconvert model.obj model.scn [-scale s] [-material m] [-noopt]
+// Each object or group of the file becomes a mesh with one instance.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "objimport.h"
+#include "scenefile.h"
+#include "meshopt.h"
+
+int main(int argc, char *argv[])
+{
+    if( argc < 3 )
+    {
+        fprintf(stderr, "usage: %s in.obj out.scn [-scale s] [-material m] [-noopt]\n", argv[0]);
+        return 1;
+    }
+
+    float scale = 1.0f;
+    int material = 0;
+    bool optimize = true;
+    for( int i = 3; i < argc; i++ )
+    {
+        std::string arg = argv[i];
+        if( arg == "-scale" && i + 1 < argc )
+            scale = (float)atof(argv[++i]);
+        else if( arg == "-material" && i + 1 < argc )
+            material = atoi(argv[++i]);
+        else if( arg == "-noopt" )
+            optimize = false;
+        else
+            fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+    }
+
+    std::vector<ImportedMesh> meshes;
+    if( !importObj(argv[1], meshes) )
+    {
+        fprintf(stderr, "Cannot read %s\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<SceneFileMeshData> data(meshes.size());
+    std::vector<SceneFileObject> objects(meshes.size());
+    for( size_t m = 0; m < meshes.size(); m++ )
+    {
+        ImportedMesh &mesh = meshes[m];
+        int nverts = (int)mesh.verts.size(), nelements = (int)mesh.el.size();
+
+        // Same triangle order as the demo's own meshes
+        if( optimize )
+        {
+            optimizeVertexCache(&mesh.el[0], nelements, nverts);
+            optimizeOverdraw(&mesh.el[0], nelements, mesh.verts[0].position, nverts, VERTEX_FLOATS, OVERDRAW_THRESHOLD);
+        }
+        data[m].verts = &mesh.verts[0];
+        data[m].nverts = nverts;
+        data[m].el = &mesh.el[0];
+        data[m].nelements = nelements;
+
+        SceneFileObject &object = objects[m];
+        object.mesh = (int)m;
+        object.material = material;
+        object.castsShadow = 1;
+        for( int k = 0; k < 3; k++ )
+        {
+            object.translation[k] = 0.0f;
+            object.axis[k] = (k == 2) ? 1.0f : 0.0f;
+            object.scale[k] = scale;
+        }
+        object.angle = 0.0f;
+
+        printf("%s: %d vertices, %d triangles\n", mesh.name.c_str(), nverts, nelements / 3);
+    }
+
+    if( !sceneFileWrite(argv[2], data.empty() ? NULL : &data[0], (int)data.size(),
+                        objects.empty() ? NULL : &objects[0], (int)objects.size()) )
+    {
+        fprintf(stderr, "Cannot write %s\n", argv[2]);
+        return 1;
+    }
+    return 0;
+}
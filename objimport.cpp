@@ -0,0 +1,190 @@
+#include "objimport.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+namespace {
+
+// A face corner: indices into the file's position, texcoord and normal
+// lists, -1 when absent
+struct Corner {
+    int v, vt, vn;
+    bool operator==(const Corner &o) const { return v == o.v && vt == o.vt && vn == o.vn; }
+};
+
+struct CornerHash {
+    size_t operator()(const Corner &c) const
+    {
+        return ((size_t)c.v * 73856093u) ^ ((size_t)c.vt * 19349663u) ^ ((size_t)c.vn * 83492791u);
+    }
+};
+
+// The mesh being read and its corner to vertex map
+struct MeshBuilder {
+    ImportedMesh mesh;
+    std::unordered_map<Corner, unsigned int, CornerHash> vertexOf;
+    std::vector<unsigned char> hasNormal;
+};
+
+// OBJ indices start at 1 and negative ones count back from the last element
+int resolveIndex(long i, size_t count)
+{
+    long r = i < 0 ? (long)count + i : i - 1;
+    return (r >= 0 && r < (long)count) ? (int)r : -1;
+}
+
+// Appends n numbers, missing ones as 0 (a "vt u" line has no v)
+void readFloats(const char *p, int n, std::vector<float> &out)
+{
+    for( int k = 0; k < n; k++ )
+    {
+        char *end;
+        out.push_back(strtof(p, &end));
+        p = end;
+    }
+}
+
+// Parses "v", "v/vt", "v//vn" or "v/vt/vn"
+bool parseCorner(const char *&p, size_t npositions, size_t ntexcoords, size_t nnormals, Corner &c)
+{
+    char *end;
+    c.vt = c.vn = -1;
+    c.v = resolveIndex(strtol(p, &end, 10), npositions);
+    if( end == p || c.v < 0 )
+        return false;
+    p = end;
+    if( *p == '/' )
+    {
+        p++;
+        if( *p != '/' )
+        {
+            c.vt = resolveIndex(strtol(p, &end, 10), ntexcoords);
+            p = end;
+        }
+        if( *p == '/' )
+        {
+            p++;
+            c.vn = resolveIndex(strtol(p, &end, 10), nnormals);
+            p = end;
+        }
+    }
+    return true;
+}
+
+unsigned int cornerVertex(MeshBuilder &b, const Corner &c, const std::vector<float> &positions,
+                          const std::vector<float> &texcoords, const std::vector<float> &normals)
+{
+    std::unordered_map<Corner, unsigned int, CornerHash>::iterator it = b.vertexOf.find(c);
+    if( it != b.vertexOf.end() )
+        return it->second;
+
+    Vertex vtx;
+    memset(&vtx, 0, sizeof(vtx));
+    for( int k = 0; k < 3; k++ )
+        vtx.position[k] = positions[3 * c.v + k];
+    if( c.vn >= 0 )
+        for( int k = 0; k < 3; k++ )
+            vtx.normal[k] = normals[3 * c.vn + k];
+    if( c.vt >= 0 )
+        for( int k = 0; k < 2; k++ )
+            vtx.texCoord[k] = texcoords[2 * c.vt + k];
+
+    unsigned int index = (unsigned int)b.mesh.verts.size();
+    b.mesh.verts.push_back(vtx);
+    b.hasNormal.push_back(c.vn >= 0);
+    b.vertexOf[c] = index;
+    return index;
+}
+
+// Fills in the missing normals and moves the mesh to the output, if it has
+// any triangles
+void finishMesh(MeshBuilder &b, std::vector<ImportedMesh> &meshes)
+{
+    std::vector<Vertex> &verts = b.mesh.verts;
+    const std::vector<unsigned int> &el = b.mesh.el;
+    for( size_t t = 0; t + 2 < el.size(); t += 3 )
+    {
+        const float *p0 = verts[el[t]].position, *p1 = verts[el[t + 1]].position, *p2 = verts[el[t + 2]].position;
+        float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        for( int c = 0; c < 3; c++ )
+            if( !b.hasNormal[el[t + c]] )
+                for( int k = 0; k < 3; k++ )
+                    verts[el[t + c]].normal[k] += n[k];
+    }
+    for( size_t i = 0; i < verts.size(); i++ )
+    {
+        if( b.hasNormal[i] )
+            continue;
+        float *n = verts[i].normal;
+        float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if( len > 0.0f )
+            for( int k = 0; k < 3; k++ )
+                n[k] /= len;
+    }
+
+    if( !el.empty() )
+        meshes.push_back(b.mesh);
+    b.mesh.verts.clear();
+    b.mesh.el.clear();
+    b.vertexOf.clear();
+    b.hasNormal.clear();
+}
+
+}
+
+bool importObj(const std::string &path, std::vector<ImportedMesh> &meshes)
+{
+    std::ifstream f(path.c_str());
+    if( !f.is_open() )
+        return false;
+
+    std::vector<float> positions, texcoords, normals;
+    MeshBuilder builder;
+    std::vector<unsigned int> face;
+    std::string line;
+    while( std::getline(f, line) )
+    {
+        const char *p = line.c_str();
+        while( *p == ' ' || *p == '\t' )
+            p++;
+
+        if( p[0] == 'v' && (p[1] == ' ' || p[1] == '\t') )
+            readFloats(p + 1, 3, positions);
+        else if( p[0] == 'v' && p[1] == 't' )
+            readFloats(p + 2, 2, texcoords);
+        else if( p[0] == 'v' && p[1] == 'n' )
+            readFloats(p + 2, 3, normals);
+        else if( p[0] == 'f' && (p[1] == ' ' || p[1] == '\t') )
+        {
+            face.clear();
+            p++;
+            for( ;; )
+            {
+                while( *p == ' ' || *p == '\t' )
+                    p++;
+                Corner c;
+                if( !parseCorner(p, positions.size() / 3, texcoords.size() / 2, normals.size() / 3, c) )
+                    break;
+                face.push_back(cornerVertex(builder, c, positions, texcoords, normals));
+            }
+            for( size_t i = 2; i < face.size(); i++ )
+            {
+                builder.mesh.el.push_back(face[0]);
+                builder.mesh.el.push_back(face[i - 1]);
+                builder.mesh.el.push_back(face[i]);
+            }
+        }
+        else if( (p[0] == 'o' || p[0] == 'g') && (p[1] == ' ' || p[1] == '\t' || p[1] == '\0') )
+        {
+            finishMesh(builder, meshes);
+            builder.mesh.name = p[1] ? p + 2 : "";
+        }
+    }
+    finishMesh(builder, meshes);
+    return true;
+}
@@ -0,0 +1,24 @@
+#ifndef OBJIMPORT_H
+#define OBJIMPORT_H
+
+#include <string>
+#include <vector>
+#include "vertexformat.h"
+
+// Wavefront OBJ reader for objconvert. Only geometry is read: positions,
+// normals, texture coordinates and faces; materials are ignored.
+
+struct ImportedMesh {
+    std::string name;
+    std::vector<Vertex> verts;
+    std::vector<unsigned int> el;       // triangle list
+};
+
+// Reads the file as one mesh per object or group ('o' and 'g' lines).
+// Polygons are split into triangle fans and corners with the same
+// position/texcoord/normal triple share a vertex. Vertices without a normal
+// get the area weighted normal of their triangles, and those without texture
+// coordinates get zeros. Returns false if the file cannot be read.
+bool importObj(const std::string &path, std::vector<ImportedMesh> &meshes);
+
+#endif // OBJIMPORT_H
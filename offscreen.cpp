@@ -0,0 +1,150 @@
+#include "offscreen.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+EGLDisplay display = EGL_NO_DISPLAY;
+EGLContext context = EGL_NO_CONTEXT;
+EGLSurface surface = EGL_NO_SURFACE;    // only without surfaceless contexts
+
+bool hasExtension(const char *extensions, const char *name)
+{
+    size_t length = strlen(name);
+    for( const char *p = extensions; p && (p = strstr(p, name)); p += length )
+        if( (p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0') )
+            return true;
+    return false;
+}
+
+// The surfaceless platform if the client supports it, otherwise whatever
+// the default display is
+EGLDisplay openDisplay()
+{
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    // NULL, with an error set, when there are no client extensions
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if( hasExtension(extensions, "EGL_MESA_platform_surfaceless") && getPlatformDisplay )
+    {
+        EGLDisplay d = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if( d != EGL_NO_DISPLAY )
+            return d;
+    }
+#endif
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+}
+
+bool offscreenCreateContext()
+{
+    EGLint major, minor;
+    display = openDisplay();
+    if( display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor) )
+    {
+        std::cerr << "Cannot initialize EGL" << std::endl;
+        display = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    // Nothing is drawn to the surface, so the config only needs desktop GL
+    static const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint nconfigs = 0;
+    if( !eglChooseConfig(display, configAttribs, &config, 1, &nconfigs) || nconfigs == 0 ||
+        !eglBindAPI(EGL_OPENGL_API) )
+    {
+        std::cerr << "EGL has no OpenGL config" << std::endl;
+        offscreenDestroyContext();
+        return false;
+    }
+
+    // No version asked for: Mesa then gives its newest compatibility
+    // profile, which the fixed function calls in init() need
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if( context != EGL_NO_CONTEXT && !hasExtension(extensions, "EGL_KHR_surfaceless_context") )
+    {
+        static const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+    }
+    if( context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context) )
+    {
+        std::cerr << "Cannot create an EGL context" << std::endl;
+        offscreenDestroyContext();
+        return false;
+    }
+
+    std::cout << "EGL " << major << "." << minor << " (" << eglQueryString(display, EGL_VENDOR) << ")" << std::endl;
+    return true;
+}
+
+void offscreenDestroyContext()
+{
+    if( display == EGL_NO_DISPLAY )
+        return;
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if( context != EGL_NO_CONTEXT )
+        eglDestroyContext(display, context);
+    if( surface != EGL_NO_SURFACE )
+        eglDestroySurface(display, surface);
+    eglTerminate(display);
+    display = EGL_NO_DISPLAY;
+    context = EGL_NO_CONTEXT;
+    surface = EGL_NO_SURFACE;
+}
+
+bool offscreenTargetInit(OffscreenTarget &target, int width, int height)
+{
+    target.width = width;
+    target.height = height;
+
+    glGenRenderbuffers(1, &target.color);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &target.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &target.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depth);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    if( !complete )
+    {
+        std::cerr << "Offscreen framebuffer is not complete" << std::endl;
+        offscreenTargetDestroy(target);
+    }
+    return complete;
+}
+
+void offscreenTargetDestroy(OffscreenTarget &target)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &target.fbo);
+    glDeleteRenderbuffers(1, &target.color);
+    glDeleteRenderbuffers(1, &target.depth);
+    target.fbo = target.color = target.depth = 0;
+}
+
+void offscreenReadPixels(const OffscreenTarget &target, unsigned char *pixels)
+{
+    GLint framebuffer;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, target.width, target.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+}
@@ -0,0 +1,31 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+#include <GL/glew.h>
+
+// GL without a window, for the headless mode. The context comes from EGL,
+// on Mesa's surfaceless platform when it is there, which needs neither a
+// display nor a GPU (llvmpipe renders in software). Frames are drawn into
+// an offscreen target and read back.
+
+// Creates a context and makes it current. Returns false if EGL has no
+// desktop GL context to offer.
+bool offscreenCreateContext();
+void offscreenDestroyContext();
+
+// Framebuffer standing in for the window's, with an RGBA8 color and a
+// 24-bit depth renderbuffer. Needs GLEW initialized.
+struct OffscreenTarget {
+    GLuint fbo;
+    GLuint color, depth;
+    int width, height;
+};
+
+bool offscreenTargetInit(OffscreenTarget &target, int width, int height);
+void offscreenTargetDestroy(OffscreenTarget &target);
+
+// Copies the color buffer to pixels, width * height * 4 bytes with rows from
+// bottom to top. Waits for the frame to finish.
+void offscreenReadPixels(const OffscreenTarget &target, unsigned char *pixels);
+
+#endif // OFFSCREEN_H
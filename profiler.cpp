@@ -0,0 +1,294 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Section {
+    std::string name;
+    bool gpu;
+    GLuint queries[PROFILE_BUFFERS];
+};
+
+// The last PROFILE_HISTORY samples of a section in one mode
+struct History {
+    float samples[PROFILE_HISTORY];
+    int next, count;
+};
+
+struct Event {
+    int frame, mode, section;
+    double beginUs;             // since profileInit
+    float cpuMs;
+    float gpuMs;                // negative when not measured
+};
+
+Section sections[PROFILE_MAX_SECTIONS];
+int nsections = 0;
+int nmodes = 1;
+bool useQueries = false;
+Clock::time_point epoch;
+
+int frame = -1;
+int frameMode = 0;
+int frameCount[PROFILE_MAX_MODES];
+int runCount[PROFILE_MAX_MODES][PROFILE_MAX_SECTIONS];
+History cpuHistory[PROFILE_MAX_MODES][PROFILE_MAX_SECTIONS];
+History gpuHistory[PROFILE_MAX_MODES][PROFILE_MAX_SECTIONS];
+
+// Sections begun this frame, and those of each query buffer still waiting
+// for their GPU time
+Clock::time_point started[PROFILE_MAX_SECTIONS];
+Event pending[PROFILE_BUFFERS][PROFILE_MAX_SECTIONS];
+bool pendingUsed[PROFILE_BUFFERS][PROFILE_MAX_SECTIONS];
+
+bool capturing = false;
+std::vector<Event> events;
+
+void addSample(History &h, float ms)
+{
+    h.samples[h.next] = ms;
+    h.next = (h.next + 1) % PROFILE_HISTORY;
+    h.count = std::min(h.count + 1, PROFILE_HISTORY);
+}
+
+void computeStats(const History &h, ProfileStats &stats)
+{
+    stats.count = h.count;
+    stats.avg = stats.min = stats.max = 0.0f;
+    if( !h.count )
+        return;
+    stats.min = stats.max = h.samples[0];
+    float sum = 0.0f;
+    for( int i = 0; i < h.count; i++ )
+    {
+        sum += h.samples[i];
+        stats.min = std::min(stats.min, h.samples[i]);
+        stats.max = std::max(stats.max, h.samples[i]);
+    }
+    stats.avg = sum / h.count;
+}
+
+void record(const Event &e)
+{
+    if( capturing && events.size() < PROFILE_MAX_EVENTS )
+        events.push_back(e);
+}
+
+// Reads the queries of a buffer that are done; the others are dropped
+void collect(int buffer)
+{
+    for( int s = 0; s < nsections; s++ )
+    {
+        if( !pendingUsed[buffer][s] )
+            continue;
+        Event &e = pending[buffer][s];
+        GLuint available = 0;
+        glGetQueryObjectuiv(sections[s].queries[buffer], GL_QUERY_RESULT_AVAILABLE, &available);
+        if( available )
+        {
+            GLuint64 ns;
+            glGetQueryObjectui64v(sections[s].queries[buffer], GL_QUERY_RESULT, &ns);
+            e.gpuMs = ns / 1e6f;
+            addSample(gpuHistory[e.mode][s], e.gpuMs);
+        }
+        record(e);
+        pendingUsed[buffer][s] = false;
+    }
+}
+
+bool byFrame(const Event &a, const Event &b)
+{
+    return a.frame != b.frame ? a.frame < b.frame : a.beginUs < b.beginUs;
+}
+
+bool byBegin(const Event &a, const Event &b)
+{
+    return a.beginUs < b.beginUs;
+}
+
+}
+
+void profileInit(int modes)
+{
+    nmodes = std::min(std::max(modes, 1), PROFILE_MAX_MODES);
+    useQueries = GLEW_ARB_timer_query != 0;
+    epoch = Clock::now();
+}
+
+int profileAddSection(const char *name, bool gpu)
+{
+    if( nsections == PROFILE_MAX_SECTIONS )
+        return -1;
+    Section &section = sections[nsections];
+    section.name = name;
+    section.gpu = gpu && useQueries;
+    if( section.gpu )
+        glGenQueries(PROFILE_BUFFERS, section.queries);
+    return nsections++;
+}
+
+void profileShutdown()
+{
+    for( int s = 0; s < nsections; s++ )
+    {
+        if( sections[s].gpu )
+        {
+            glDeleteQueries(PROFILE_BUFFERS, sections[s].queries);
+            sections[s].gpu = false;
+        }
+    }
+    useQueries = false;
+}
+
+void profileCapture(bool capture)
+{
+    capturing = capture;
+}
+
+void profileBeginFrame(int mode)
+{
+    frame++;
+    frameMode = std::min(std::max(mode, 0), nmodes - 1);
+    frameCount[frameMode]++;
+    collect(frame % PROFILE_BUFFERS);
+}
+
+void profileBegin(int section)
+{
+    if( section < 0 )
+        return;
+    started[section] = Clock::now();
+    if( sections[section].gpu )
+        glBeginQuery(GL_TIME_ELAPSED, sections[section].queries[frame % PROFILE_BUFFERS]);
+}
+
+void profileEnd(int section)
+{
+    if( section < 0 )
+        return;
+    Clock::time_point now = Clock::now();
+    Event e;
+    e.frame = frame;
+    e.mode = frameMode;
+    e.section = section;
+    e.beginUs = std::chrono::duration<double, std::micro>(started[section] - epoch).count();
+    e.cpuMs = std::chrono::duration<float, std::milli>(now - started[section]).count();
+    e.gpuMs = -1.0f;
+    addSample(cpuHistory[frameMode][section], e.cpuMs);
+    runCount[frameMode][section]++;
+
+    if( sections[section].gpu )
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        int buffer = frame % PROFILE_BUFFERS;
+        pending[buffer][section] = e;
+        pendingUsed[buffer][section] = true;
+    }
+    else
+        record(e);
+}
+
+void profileCpuStats(int mode, int section, ProfileStats &stats)
+{
+    computeStats(cpuHistory[mode][section], stats);
+}
+
+void profileGpuStats(int mode, int section, ProfileStats &stats)
+{
+    computeStats(gpuHistory[mode][section], stats);
+}
+
+void profileReport(const char *const *modeNames)
+{
+    for( int m = 0; m < nmodes; m++ )
+    {
+        if( !frameCount[m] )
+            continue;
+        // Sections skipped in some frames, like a reused shadow map, show
+        // the share of frames they ran in
+        printf("%-16s %7d frames %8s %8s %8s %8s %5s\n", modeNames ? modeNames[m] : "", frameCount[m],
+               "cpu avg", "cpu max", "gpu avg", "gpu max", "runs");
+        for( int s = 0; s < nsections; s++ )
+        {
+            ProfileStats cpu, gpu;
+            profileCpuStats(m, s, cpu);
+            profileGpuStats(m, s, gpu);
+            if( !cpu.count )
+                continue;
+            printf("  %-22s %8.3f %8.3f", sections[s].name.c_str(), cpu.avg, cpu.max);
+            if( gpu.count )
+                printf(" %8.3f %8.3f", gpu.avg, gpu.max);
+            else
+                printf(" %8s %8s", "-", "-");
+            printf(" %4d%%\n", (int)(100LL * runCount[m][s] / frameCount[m]));
+        }
+    }
+    fflush(stdout);
+}
+
+void profileFlush()
+{
+    if( !useQueries )
+        return;
+    glFinish();
+    for( int i = 1; i <= PROFILE_BUFFERS; i++ )
+        collect((frame + i) % PROFILE_BUFFERS);
+}
+
+bool profileWriteCsv(const std::string &path)
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if( !f )
+        return false;
+    std::vector<Event> sorted = events;
+    std::stable_sort(sorted.begin(), sorted.end(), byFrame);
+    fprintf(f, "frame,mode,section,begin_ms,cpu_ms,gpu_ms\n");
+    for( size_t i = 0; i < sorted.size(); i++ )
+    {
+        const Event &e = sorted[i];
+        fprintf(f, "%d,%d,%s,%.3f,%.4f,", e.frame, e.mode, sections[e.section].name.c_str(),
+                e.beginUs / 1000.0, e.cpuMs);
+        if( e.gpuMs >= 0.0f )
+            fprintf(f, "%.4f", e.gpuMs);
+        fprintf(f, "\n");
+    }
+    return fclose(f) == 0;
+}
+
+bool profileWriteTrace(const std::string &path)
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if( !f )
+        return false;
+    std::vector<Event> sorted = events;
+    std::stable_sort(sorted.begin(), sorted.end(), byBegin);
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+    double gpuEnd = 0.0;
+    for( size_t i = 0; i < sorted.size(); i++ )
+    {
+        const Event &e = sorted[i];
+        const char *name = sections[e.section].name.c_str();
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"args\":{\"frame\":%d,\"mode\":%d}}",
+                name, e.beginUs, e.cpuMs * 1000.0, e.frame, e.mode);
+        if( e.gpuMs >= 0.0f )
+        {
+            double begin = std::max(e.beginUs, gpuEnd);
+            gpuEnd = begin + e.gpuMs * 1000.0;
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f,"
+                       "\"args\":{\"frame\":%d,\"mode\":%d}}",
+                    name, begin, e.gpuMs * 1000.0, e.frame, e.mode);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
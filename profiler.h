@@ -0,0 +1,58 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <GL/glew.h>
+#include <string>
+
+// Per-pass frame timings. Each section is timed on the CPU and, if asked
+// for, on the GPU with a GL_TIME_ELAPSED query. Queries are double buffered:
+// a frame's results are read two frames later, and dropped if the GPU has
+// not got there yet, so timing never stalls the pipeline. GPU sections must
+// not nest, since only one elapsed time query can be active.
+//
+// Samples are kept per mode (the caller's, e.g. the shadow filter) so costs
+// under different settings stay apart. Stats cover the last
+// PROFILE_HISTORY samples of each section; a section that does not run in
+// a frame adds no sample.
+
+#define PROFILE_MAX_SECTIONS 16
+#define PROFILE_MAX_MODES 8
+#define PROFILE_HISTORY 120
+#define PROFILE_BUFFERS 2
+#define PROFILE_MAX_EVENTS (1 << 19)    // samples kept for export
+
+struct ProfileStats {
+    int count;                  // samples in the window
+    float avg, min, max;        // milliseconds
+};
+
+// Sections are numbered in the order they are added
+void profileInit(int nmodes);
+int profileAddSection(const char *name, bool gpu);
+void profileShutdown();         // deletes the queries; samples and stats stay
+
+// Keeps every sample from now on, up to PROFILE_MAX_EVENTS, for export
+void profileCapture(bool capture);
+
+// Collects the results of the frame two frames back and starts a new one
+// in mode
+void profileBeginFrame(int mode);
+void profileBegin(int section);
+void profileEnd(int section);
+
+void profileCpuStats(int mode, int section, ProfileStats &stats);
+void profileGpuStats(int mode, int section, ProfileStats &stats);
+
+// Prints the stats of every mode with samples, one table per mode
+void profileReport(const char *const *modeNames);
+
+// Waits for the pending queries, then writes the captured samples. The CSV
+// has a row per sample; the trace is Chrome's JSON format (chrome://tracing
+// or Perfetto) with a CPU and a GPU track. Elapsed time queries carry no
+// start time, so GPU events start when their CPU section did or when the
+// previous one ended, whichever is later.
+void profileFlush();
+bool profileWriteCsv(const std::string &path);
+bool profileWriteTrace(const std::string &path);
+
+#endif // PROFILER_H
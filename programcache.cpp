@@ -0,0 +1,91 @@
+#include "programcache.h"
+
+#include <cstring>
+#include <vector>
+
+// Bump when the file layout changes
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramCacheHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned long long key;
+    unsigned int format;    // GLenum from glGetProgramBinary
+    unsigned int size;      // bytes of binary after the header
+};
+
+bool programCacheSupported()
+{
+    if( !GLEW_ARB_get_program_binary )
+        return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+static unsigned long long hashString(const char *s, unsigned long long h)
+{
+    // The terminator separates consecutive strings
+    return s ? hashBytes(s, strlen(s) + 1, h) : hashBytes("", 1, h);
+}
+
+unsigned long long programCacheKey(const std::string &vertexSource, const std::string &fragmentSource)
+{
+    unsigned int version = PROGRAM_CACHE_VERSION;
+    unsigned long long h = hashBytes(&version, sizeof(version));
+    h = hashString((const char *)glGetString(GL_VENDOR), h);
+    h = hashString((const char *)glGetString(GL_RENDERER), h);
+    h = hashString((const char *)glGetString(GL_VERSION), h);
+    h = hashString(vertexSource.c_str(), h);
+    return hashString(fragmentSource.c_str(), h);
+}
+
+bool programCacheLoad(GLuint program, unsigned long long key)
+{
+    MappedFile file;
+    if( !mapFile(cachePath("program", key, ".bin"), file) )
+        return false;
+
+    const ProgramCacheHeader *h = (const ProgramCacheHeader *)file.data;
+    bool valid = file.size >= sizeof(ProgramCacheHeader) &&
+                 memcmp(h->magic, "PROG", 4) == 0 &&
+                 h->version == PROGRAM_CACHE_VERSION &&
+                 h->key == key &&
+                 sizeof(ProgramCacheHeader) + h->size <= file.size;
+
+    GLint linked = GL_FALSE;
+    if( valid )
+    {
+        glProgramBinary(program, h->format, file.data + sizeof(ProgramCacheHeader), h->size);
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    }
+    unmapFile(file);
+    return linked == GL_TRUE;
+}
+
+bool programCacheStore(GLuint program, unsigned long long key)
+{
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if( size <= 0 )
+        return false;
+
+    std::vector<unsigned char> binary(size);
+    GLenum format;
+    GLsizei length = 0;
+    glGetProgramBinary(program, size, &length, &format, &binary[0]);
+    if( length <= 0 )
+        return false;
+
+    ProgramCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "PROG", 4);
+    h.version = PROGRAM_CACHE_VERSION;
+    h.key = key;
+    h.format = format;
+    h.size = length;
+
+    const void *chunks[2] = { &h, &binary[0] };
+    size_t sizes[2] = { sizeof(h), (size_t)length };
+    return writeFileAtomic(cachePath("program", key, ".bin"), chunks, sizes, 2);
+}
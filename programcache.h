@@ -0,0 +1,28 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <GL/glew.h>
+#include <string>
+#include "diskcache.h"
+
+// Linked program binaries keyed by the shader sources, their defines and the
+// GL implementation. A file holds a versioned header with the binary format
+// followed by the blob from glGetProgramBinary. Drivers may reject a binary
+// at any time, so a load failure just means compiling the program again.
+
+// True if the context can save and restore program binaries
+bool programCacheSupported();
+
+// Key of the program built from these sources, including the renderer,
+// vendor and version strings of the current context
+unsigned long long programCacheKey(const std::string &vertexSource, const std::string &fragmentSource);
+
+// Loads the binary for key into program. Returns false on a miss, a stale
+// file or a binary the driver does not accept.
+bool programCacheLoad(GLuint program, unsigned long long key);
+
+// Stores the binary of a linked program. It must have been linked with
+// GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+bool programCacheStore(GLuint program, unsigned long long key);
+
+#endif // PROGRAMCACHE_H
@@ -0,0 +1,180 @@
+#include "scene.h"
+#include "jobs.h"
+#include <cmath>
+#include <algorithm>
+
+void sceneInit(Scene &scene, int capacity)
+{
+    scene.count = 0;
+    scene.capacity = capacity;
+    scene.tx = new float[capacity];
+    scene.ty = new float[capacity];
+    scene.tz = new float[capacity];
+    scene.axisX = new float[capacity];
+    scene.axisY = new float[capacity];
+    scene.axisZ = new float[capacity];
+    scene.angle = new float[capacity];
+    scene.sx = new float[capacity];
+    scene.sy = new float[capacity];
+    scene.sz = new float[capacity];
+    scene.mesh = new int[capacity];
+    scene.material = new int[capacity];
+    scene.castsShadow = new unsigned char[capacity];
+    scene.shadowCullFace = new unsigned int[capacity];
+    scene.world = new glm::mat4[capacity];
+    scene.boundsX = new float[capacity];
+    scene.boundsY = new float[capacity];
+    scene.boundsZ = new float[capacity];
+    scene.boundsR = new float[capacity];
+}
+
+void sceneDestroy(Scene &scene)
+{
+    delete [] scene.tx;
+    delete [] scene.ty;
+    delete [] scene.tz;
+    delete [] scene.axisX;
+    delete [] scene.axisY;
+    delete [] scene.axisZ;
+    delete [] scene.angle;
+    delete [] scene.sx;
+    delete [] scene.sy;
+    delete [] scene.sz;
+    delete [] scene.mesh;
+    delete [] scene.material;
+    delete [] scene.castsShadow;
+    delete [] scene.shadowCullFace;
+    delete [] scene.world;
+    delete [] scene.boundsX;
+    delete [] scene.boundsY;
+    delete [] scene.boundsZ;
+    delete [] scene.boundsR;
+    scene.count = scene.capacity = 0;
+}
+
+// Moves the first count elements of array to a new one of capacity elements
+template <typename T>
+static void growArray(T *&array, int count, int capacity)
+{
+    T *grown = new T[capacity];
+    std::copy(array, array + count, grown);
+    delete [] array;
+    array = grown;
+}
+
+void sceneReserve(Scene &scene, int capacity)
+{
+    if( capacity <= scene.capacity )
+        return;
+    int n = scene.count;
+    growArray(scene.tx, n, capacity);
+    growArray(scene.ty, n, capacity);
+    growArray(scene.tz, n, capacity);
+    growArray(scene.axisX, n, capacity);
+    growArray(scene.axisY, n, capacity);
+    growArray(scene.axisZ, n, capacity);
+    growArray(scene.angle, n, capacity);
+    growArray(scene.sx, n, capacity);
+    growArray(scene.sy, n, capacity);
+    growArray(scene.sz, n, capacity);
+    growArray(scene.mesh, n, capacity);
+    growArray(scene.material, n, capacity);
+    growArray(scene.castsShadow, n, capacity);
+    growArray(scene.shadowCullFace, n, capacity);
+    growArray(scene.world, n, capacity);
+    growArray(scene.boundsX, n, capacity);
+    growArray(scene.boundsY, n, capacity);
+    growArray(scene.boundsZ, n, capacity);
+    growArray(scene.boundsR, n, capacity);
+    scene.capacity = capacity;
+}
+
+int sceneAdd(Scene &scene, int mesh, int material, bool castsShadow, unsigned int shadowCullFace)
+{
+    if( scene.count == scene.capacity )
+        sceneReserve(scene, std::max(2 * scene.capacity, 16));
+
+    int i = scene.count++;
+    scene.tx[i] = scene.ty[i] = scene.tz[i] = 0.0f;
+    scene.axisX[i] = 0.0f;
+    scene.axisY[i] = 0.0f;
+    scene.axisZ[i] = 1.0f;
+    scene.angle[i] = 0.0f;
+    scene.sx[i] = scene.sy[i] = scene.sz[i] = 1.0f;
+    scene.mesh[i] = mesh;
+    scene.material[i] = material;
+    scene.castsShadow[i] = castsShadow ? 1 : 0;
+    scene.shadowCullFace[i] = shadowCullFace;
+    return i;
+}
+
+void sceneSetTranslation(Scene &scene, int object, const glm::vec3 &t)
+{
+    scene.tx[object] = t.x;
+    scene.ty[object] = t.y;
+    scene.tz[object] = t.z;
+}
+
+void sceneSetRotation(Scene &scene, int object, float angle, const glm::vec3 &axis)
+{
+    glm::vec3 a = glm::normalize(axis);
+    scene.axisX[object] = a.x;
+    scene.axisY[object] = a.y;
+    scene.axisZ[object] = a.z;
+    scene.angle[object] = angle;
+}
+
+void sceneSetScale(Scene &scene, int object, const glm::vec3 &s)
+{
+    scene.sx[object] = s.x;
+    scene.sy[object] = s.y;
+    scene.sz[object] = s.z;
+}
+
+// Objects per job of sceneUpdate. Each writes only its own outputs, so the
+// chunks need no synchronization.
+static const int UPDATE_CHUNK = 64;
+
+static void updateRange(Scene &scene, const BoundingSphere *meshBounds, int begin, int end)
+{
+    const float degrees = 3.14159265358979323846f / 180.0f;
+    for( int i = begin; i < end; i++ )
+    {
+        // Rotation columns as glm::rotate builds them
+        float c = cos(scene.angle[i] * degrees), s = sin(scene.angle[i] * degrees);
+        float ax = scene.axisX[i], ay = scene.axisY[i], az = scene.axisZ[i];
+        float r[3][3] = {
+            { c + (1 - c) * ax * ax, (1 - c) * ax * ay + s * az, (1 - c) * ax * az - s * ay },
+            { (1 - c) * ay * ax - s * az, c + (1 - c) * ay * ay, (1 - c) * ay * az + s * ax },
+            { (1 - c) * az * ax + s * ay, (1 - c) * az * ay - s * ax, c + (1 - c) * az * az },
+        };
+
+        // scale * rotate * translate: the upper 3x3 is S R, the translation S R t
+        float scale[3] = { scene.sx[i], scene.sy[i], scene.sz[i] };
+        glm::mat4 &m = scene.world[i];
+        for( int col = 0; col < 3; col++ )
+        {
+            for( int row = 0; row < 3; row++ )
+                m[col][row] = scale[row] * r[col][row];
+            m[col][3] = 0.0f;
+        }
+        for( int row = 0; row < 3; row++ )
+            m[3][row] = m[0][row] * scene.tx[i] + m[1][row] * scene.ty[i] + m[2][row] * scene.tz[i];
+        m[3][3] = 1.0f;
+
+        // The rotation keeps lengths, so the largest scale bounds the radius
+        const BoundingSphere &b = meshBounds[scene.mesh[i]];
+        glm::vec4 center = m * glm::vec4(b.center, 1.0f);
+        scene.boundsX[i] = center.x;
+        scene.boundsY[i] = center.y;
+        scene.boundsZ[i] = center.z;
+        scene.boundsR[i] = b.radius * std::max(fabs(scale[0]), std::max(fabs(scale[1]), fabs(scale[2])));
+    }
+}
+
+void sceneUpdate(Scene &scene, const BoundingSphere *meshBounds)
+{
+    parallelFor(scene.count, UPDATE_CHUNK, [&](int begin, int end) {
+        updateRange(scene, meshBounds, begin, end);
+    });
+}
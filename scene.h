@@ -0,0 +1,52 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+#include "bounds.h"
+
+// Scene objects stored as structure of arrays. Each object has a local
+// transform made of a translation, an axis/angle rotation and a scale,
+// composed as scale * rotate * translate like the glm::translate(
+// glm::rotate(glm::scale(...))) chains the demo used to build by hand.
+// sceneUpdate turns them into contiguous world matrices and world bounding
+// spheres once per frame, and every pass reads those.
+
+struct Scene {
+    int count;
+    int capacity;
+
+    float *tx, *ty, *tz;                    // translation, applied first
+    float *axisX, *axisY, *axisZ, *angle;   // rotation, angle in degrees
+    float *sx, *sy, *sz;                    // scale, applied last
+
+    int *mesh;
+    int *material;
+    unsigned char *castsShadow;
+    unsigned int *shadowCullFace;           // GL_FRONT or GL_BACK
+
+    // Outputs of sceneUpdate
+    glm::mat4 *world;
+    float *boundsX, *boundsY, *boundsZ, *boundsR;
+};
+
+// The arrays start with room for capacity objects and grow as they are added
+void sceneInit(Scene &scene, int capacity);
+void sceneDestroy(Scene &scene);
+
+// Makes room for capacity objects, so a known number of them can be added
+// with a single reallocation
+void sceneReserve(Scene &scene, int capacity);
+
+// Adds an object with the identity transform and returns its index
+int sceneAdd(Scene &scene, int mesh, int material, bool castsShadow, unsigned int shadowCullFace);
+
+void sceneSetTranslation(Scene &scene, int object, const glm::vec3 &t);
+void sceneSetRotation(Scene &scene, int object, float angle, const glm::vec3 &axis);
+void sceneSetScale(Scene &scene, int object, const glm::vec3 &s);
+
+// World matrices and world bounding spheres of every object, in chunks of
+// objects across the job threads. meshBounds holds the object space sphere
+// of each mesh id.
+void sceneUpdate(Scene &scene, const BoundingSphere *meshBounds);
+
+#endif // SCENE_H
@@ -0,0 +1,160 @@
+#include "scenefile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "bounds.h"
+
+// Bump when the file layout changes
+#define SCENE_FILE_VERSION 1
+#define SCENE_FILE_ALIGN 64
+
+struct SceneFileHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned int nmeshes;
+    unsigned int nobjects;
+    unsigned long long meshTable;       // from the start of the file
+    unsigned long long objectTable;
+};
+
+static unsigned long long alignUp(unsigned long long x)
+{
+    return (x + SCENE_FILE_ALIGN - 1) & ~(unsigned long long)(SCENE_FILE_ALIGN - 1);
+}
+
+// Whether [offset, offset + size) lies in the file
+static bool inFile(const MappedFile &file, unsigned long long offset, unsigned long long size)
+{
+    return offset <= file.size && size <= file.size - offset;
+}
+
+bool sceneFileLoad(const std::string &path, SceneFile &scene)
+{
+    if( !mapFile(path, scene.file) )
+        return false;
+
+    const MappedFile &file = scene.file;
+    const SceneFileHeader *h = (const SceneFileHeader *)file.data;
+    bool valid = file.size >= sizeof(SceneFileHeader) &&
+                 memcmp(h->magic, "SCNF", 4) == 0 &&
+                 h->version == SCENE_FILE_VERSION &&
+                 h->meshTable % SCENE_FILE_ALIGN == 0 &&
+                 h->objectTable % SCENE_FILE_ALIGN == 0 &&
+                 inFile(file, h->meshTable, (unsigned long long)h->nmeshes * sizeof(SceneFileMesh)) &&
+                 inFile(file, h->objectTable, (unsigned long long)h->nobjects * sizeof(SceneFileObject));
+
+    if( valid )
+    {
+        scene.nmeshes = h->nmeshes;
+        scene.nobjects = h->nobjects;
+        scene.meshes = (const SceneFileMesh *)(file.data + h->meshTable);
+        scene.objects = (const SceneFileObject *)(file.data + h->objectTable);
+    }
+    for( int i = 0; valid && i < scene.nmeshes; i++ )
+    {
+        const SceneFileMesh &m = scene.meshes[i];
+        valid = m.vertexOffset % SCENE_FILE_ALIGN == 0 && m.indexOffset % SCENE_FILE_ALIGN == 0 &&
+                inFile(file, m.vertexOffset, (unsigned long long)m.nverts * sizeof(Vertex)) &&
+                inFile(file, m.indexOffset, (unsigned long long)m.nelements * sizeof(unsigned int));
+    }
+    for( int i = 0; valid && i < scene.nobjects; i++ )
+        valid = scene.objects[i].mesh >= 0 && scene.objects[i].mesh < scene.nmeshes;
+
+    if( !valid )
+    {
+        unmapFile(scene.file);
+        return false;
+    }
+    return true;
+}
+
+void sceneFileRelease(SceneFile &scene)
+{
+    unmapFile(scene.file);
+    scene.nmeshes = scene.nobjects = 0;
+}
+
+const Vertex *sceneFileVertices(const SceneFile &scene, int mesh)
+{
+    return (const Vertex *)(scene.file.data + scene.meshes[mesh].vertexOffset);
+}
+
+const unsigned int *sceneFileIndices(const SceneFile &scene, int mesh)
+{
+    return (const unsigned int *)(scene.file.data + scene.meshes[mesh].indexOffset);
+}
+
+bool sceneFileIndicesValid(const SceneFile &scene, int mesh, int first, int count)
+{
+    const unsigned int *el = sceneFileIndices(scene, mesh) + first;
+    unsigned int nverts = scene.meshes[mesh].nverts;
+    for( int i = 0; i < count; i++ )
+        if( el[i] >= nverts )
+            return false;
+    return true;
+}
+
+// Writes size bytes of data preceded by zeros up to offset
+static bool writeAt(FILE *f, unsigned long long &written, unsigned long long offset, const void *data, size_t size)
+{
+    static const unsigned char zeros[SCENE_FILE_ALIGN] = { 0 };
+    size_t pad = (size_t)(offset - written);
+    bool ok = fwrite(zeros, 1, pad, f) == pad && fwrite(data, 1, size, f) == size;
+    written = offset + size;
+    return ok;
+}
+
+bool sceneFileWrite(const std::string &path, const SceneFileMeshData *meshes, int nmeshes,
+                    const SceneFileObject *objects, int nobjects)
+{
+    SceneFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "SCNF", 4);
+    h.version = SCENE_FILE_VERSION;
+    h.nmeshes = nmeshes;
+    h.nobjects = nobjects;
+    h.meshTable = alignUp(sizeof(h));
+    h.objectTable = alignUp(h.meshTable + nmeshes * sizeof(SceneFileMesh));
+
+    std::vector<SceneFileMesh> table(nmeshes);
+    unsigned long long offset = alignUp(h.objectTable + nobjects * sizeof(SceneFileObject));
+    for( int i = 0; i < nmeshes; i++ )
+    {
+        SceneFileMesh &m = table[i];
+        m.nverts = meshes[i].nverts;
+        m.nelements = meshes[i].nelements;
+        m.vertexOffset = offset;
+        m.indexOffset = alignUp(offset + (unsigned long long)m.nverts * sizeof(Vertex));
+        offset = alignUp(m.indexOffset + (unsigned long long)m.nelements * sizeof(unsigned int));
+
+        // An empty mesh has no vertices to bound
+        memset(m.center, 0, sizeof(m.center));
+        m.radius = 0.0f;
+        if( m.nverts > 0 )
+        {
+            BoundingSphere b = boundingSphere(meshes[i].verts[0].position, m.nverts, VERTEX_FLOATS);
+            m.center[0] = b.center.x;
+            m.center[1] = b.center.y;
+            m.center[2] = b.center.z;
+            m.radius = b.radius;
+        }
+    }
+
+    FILE *f = fopen(path.c_str(), "wb");
+    if( !f )
+        return false;
+
+    unsigned long long written = 0;
+    bool ok = writeAt(f, written, 0, &h, sizeof(h)) &&
+              (nmeshes == 0 || writeAt(f, written, h.meshTable, &table[0], nmeshes * sizeof(SceneFileMesh))) &&
+              (nobjects == 0 || writeAt(f, written, h.objectTable, objects, nobjects * sizeof(SceneFileObject)));
+    for( int i = 0; i < nmeshes && ok; i++ )
+        ok = writeAt(f, written, table[i].vertexOffset, meshes[i].verts, meshes[i].nverts * sizeof(Vertex)) &&
+             writeAt(f, written, table[i].indexOffset, meshes[i].el, meshes[i].nelements * sizeof(unsigned int));
+    ok = (fclose(f) == 0) && ok;
+
+    if( !ok )
+        remove(path.c_str());
+    return ok;
+}
@@ -0,0 +1,67 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <string>
+#include "diskcache.h"
+#include "vertexformat.h"
+
+// Binary scene files: a versioned header, a mesh table, an object table and
+// 64-byte aligned blocks of interleaved vertices and 32-bit indices, one pair
+// per mesh. Blocks are in the arena's own layout, so loading maps the file
+// and copies them to the GPU without converting anything. Mesh bounds are
+// stored too, so the vertices are only read once, by the upload.
+
+struct SceneFileMesh {
+    unsigned int nverts;
+    unsigned int nelements;
+    unsigned long long vertexOffset;    // from the start of the file
+    unsigned long long indexOffset;
+    float center[3];                    // object space bounding sphere
+    float radius;
+};
+
+// An instance of a mesh, with the transform the Scene store keeps
+struct SceneFileObject {
+    int mesh;
+    int material;
+    int castsShadow;
+    float translation[3];
+    float axis[3];
+    float angle;                        // degrees
+    float scale[3];
+};
+
+struct SceneFile {
+    MappedFile file;
+    int nmeshes;
+    int nobjects;
+    const SceneFileMesh *meshes;
+    const SceneFileObject *objects;
+};
+
+// Maps and checks the file. Returns false if it is missing, of another
+// version, or any table or block lies outside it. The indices are left to
+// sceneFileIndicesValid, so loading reads none of the blocks.
+bool sceneFileLoad(const std::string &path, SceneFile &scene);
+void sceneFileRelease(SceneFile &scene);
+
+const Vertex *sceneFileVertices(const SceneFile &scene, int mesh);
+const unsigned int *sceneFileIndices(const SceneFile &scene, int mesh);
+
+// Whether indices [first, first + count) of the mesh are all within its
+// vertices; those past it would read other meshes' vertices
+bool sceneFileIndicesValid(const SceneFile &scene, int mesh, int first, int count);
+
+// A mesh to write
+struct SceneFileMeshData {
+    const Vertex *verts;
+    int nverts;
+    const unsigned int *el;
+    int nelements;
+};
+
+// Writes the meshes and objects, computing the mesh bounds
+bool sceneFileWrite(const std::string &path, const SceneFileMeshData *meshes, int nmeshes,
+                    const SceneFileObject *objects, int nobjects);
+
+#endif // SCENEFILE_H
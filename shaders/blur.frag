@@ -0,0 +1,22 @@
+#version 150
+
+// Pasada de un filtro gaussiano separable de 9 muestras sobre los momentos
+in vec2 vTexCoord;
+
+out vec2 fMoments;
+
+uniform sampler2DArray uSource;
+uniform int uLayer;
+uniform vec2 uDirection; // Un texel en la direccion de la pasada
+
+void main()
+{
+	const float weights[5] = float[5](0.2270270, 0.1945946, 0.1216216, 0.0540541, 0.0162162);
+
+	fMoments = weights[0] * texture(uSource, vec3(vTexCoord, uLayer)).rg;
+	for (int i = 1; i < 5; i++)
+	{
+		fMoments += weights[i] * texture(uSource, vec3(vTexCoord + i * uDirection, uLayer)).rg;
+		fMoments += weights[i] * texture(uSource, vec3(vTexCoord - i * uDirection, uLayer)).rg;
+	}
+}
\ No newline at end of file
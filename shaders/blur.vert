@@ -0,0 +1,11 @@
+#version 150
+
+// Triangulo que cubre la pantalla, sin atributos
+out vec2 vTexCoord;
+
+void main()
+{
+	vec2 position = vec2((gl_VertexID & 1) * 4.0 - 1.0, (gl_VertexID & 2) * 2.0 - 1.0);
+	vTexCoord = position * 0.5 + 0.5;
+	gl_Position = vec4(position, 0.0, 1.0);
+}
\ No newline at end of file
@@ -1,14 +1,29 @@
 #version 150 
 
+// Variantes: DEPTH_ONLY para el mapa de profundidad (con MOMENTS escribe
+// tambien los momentos), PCF 0/1/2 para el filtrado y PCF 3 para el mapa de
+// varianza
+
+#ifdef MOMENTS
+out vec2 fMoments;
+#endif
+
+#ifndef DEPTH_ONLY
 in vec3 vECPos; // S.R. Vista
 in vec3 vECNorm; // S.R. Vista
-in vec4 vShadowTextCoord;
+in vec4 vShadowTextCoord; // S.R. clip de la luz
+flat in int vMaterial;
 
 out vec4 fFragColor;
 
-uniform int uDrawingShadowMap;
-uniform sampler2DShadow uShadowMap;
-uniform int uPCF;
+#if PCF == 3
+uniform sampler2DArray uMoments;   // Momentos filtrados, una capa por cascada
+#else
+uniform sampler2DArrayShadow uShadowMap; // Una capa por cascada
+#endif
+uniform mat4 uCascadeMatrices[4];  // Clip de la luz a coordenadas de cada capa
+uniform vec4 uCascadeSplits;       // Distancia final de cada cascada
+uniform int uCascadeCount;
 
 struct LightInfo {
 	vec4 lightPos; // Posicin de la luz (S.R. de la vista)
@@ -21,7 +36,9 @@ struct MaterialInfo {
 	vec3 specular;
 	float shininess;
 };
-uniform MaterialInfo uMaterial;
+layout(std140) uniform MaterialBlock {
+	MaterialInfo uMaterials[8];
+};
 
 
 vec3 phongModelDiffAndSpec () 
@@ -30,50 +47,70 @@ vec3 phongModelDiffAndSpec ()
 	vec3 view = normalize(vec3(-vECPos));
 	vec3 r = reflect(-ldir,vECNorm);
 
-	vec3 color = uLight.intensity * ( uMaterial.diffuse * max(dot(ldir,vECNorm), 0.0) +
-									  uMaterial.specular * pow(max(dot(r,view),0),uMaterial.shininess) );
+	vec3 color = uLight.intensity * ( uMaterials[vMaterial].diffuse * max(dot(ldir,vECNorm), 0.0) +
+									  uMaterials[vMaterial].specular * pow(max(dot(r,view),0),uMaterials[vMaterial].shininess) );
 
 	return clamp(color, 0.0, 1.0);
 }
+#endif
 
 
 void main()
 {
-	if ( uDrawingShadowMap == 0 )
-	{
-		vec3 ambient = uLight.intensity * uMaterial.ambient;
-		vec3 diffAndSpec = phongModelDiffAndSpec();
+#ifndef DEPTH_ONLY
+	vec3 ambient = uLight.intensity * uMaterials[vMaterial].ambient;
+	vec3 diffAndSpec = phongModelDiffAndSpec();
 
-		// Tarea por hacer: consultar el mapa de profundidad para calcular el factor de ocultacin (shadow)
-		float shadow = 0;
-		switch(uPCF)
-		{
-                    case 0:
-                        shadow += textureProj(uShadowMap, vShadowTextCoord);
-                        break;
-               
-                    case 1:
-                        shadow += textureProjOffset(uShadowMap, vShadowTextCoord, ivec2(-1,-1));
-                        shadow += textureProjOffset(uShadowMap, vShadowTextCoord, ivec2(1,-1));
-                        shadow += textureProjOffset(uShadowMap, vShadowTextCoord, ivec2(-1,1));
-                        shadow += textureProjOffset(uShadowMap, vShadowTextCoord, ivec2(1,1));
-                        shadow *= 0.25;
-                        break;
-                        
-                    case 2:
-                        int count = 0;
-                        for(int i=-3; i<=3; i++)
-                        {
-                            for(int j=-3; j<=3; j++)
-                            {
-                                shadow += textureProjOffset(uShadowMap, vShadowTextCoord, ivec2(i, j));
-                                count++;
-                            }
-                        }
-                        shadow /= count;
-                        break;
-                }
+	// Cascada: la primera cuyo final queda por delante del fragmento
+	float depth = -vECPos.z;
+	int layer = int(dot(step(uCascadeSplits, vec4(depth)), vec4(1.0)));
+	float inRange = float(layer < uCascadeCount);
+	layer = min(layer, uCascadeCount - 1);
+	vec4 shadowCoord = uCascadeMatrices[layer] * vShadowTextCoord;
+	shadowCoord = vec4(shadowCoord.xy / shadowCoord.w, float(layer), shadowCoord.z / shadowCoord.w);
 
-		fFragColor = vec4( clamp(ambient + shadow * diffAndSpec, 0.0, 1.0), 1.0 );
+	// Tarea por hacer: consultar el mapa de profundidad para calcular el factor de ocultacin (shadow)
+	float shadow = 0;
+#if PCF == 0
+	shadow += texture(uShadowMap, shadowCoord);
+#elif PCF == 1
+	shadow += textureOffset(uShadowMap, shadowCoord, ivec2(-1,-1));
+	shadow += textureOffset(uShadowMap, shadowCoord, ivec2(1,-1));
+	shadow += textureOffset(uShadowMap, shadowCoord, ivec2(-1,1));
+	shadow += textureOffset(uShadowMap, shadowCoord, ivec2(1,1));
+	shadow *= 0.25;
+#elif PCF == 2
+	// textureOffset solo admite desplazamientos constantes (Mesa lo exige)
+	vec2 texel = 1.0 / vec2(textureSize(uShadowMap, 0).xy);
+	for(int i=-3; i<=3; i++)
+	{
+		for(int j=-3; j<=3; j++)
+		{
+			shadow += texture(uShadowMap, shadowCoord + vec4(vec2(i, j) * texel, 0.0, 0.0));
+		}
 	}
+	shadow /= 49.0;
+#elif PCF == 3
+	// Desigualdad de Chebyshev con los momentos filtrados; se recorta la
+	// cola de pmax para reducir el sangrado de luz
+	// Los receptores tras el plano lejano de la luz se comparan con 1, como
+	// hace la comparacion del mapa de profundidad
+	vec2 moments = texture(uMoments, shadowCoord.xyz).rg;
+	float z = min(shadowCoord.w, 1.0);
+	float variance = max(moments.y - moments.x * moments.x, 1e-5);
+	float d = z - moments.x;
+	float pmax = clamp((variance / (variance + d * d) - 0.2) / 0.8, 0.0, 1.0);
+	shadow = (z <= moments.x) ? 1.0 : pmax;
+#endif
+	// Sin sombra mas alla de la ultima cascada
+	shadow = mix(1.0, shadow, inRange);
+
+	fFragColor = vec4( clamp(ambient + shadow * diffAndSpec, 0.0, 1.0), 1.0 );
+#elif defined(MOMENTS)
+	// Momentos de la profundidad, con el termino de pendiente en el segundo
+	float z = gl_FragCoord.z;
+	float dx = dFdx(z);
+	float dy = dFdy(z);
+	fMoments = vec2(z, z * z + 0.25 * (dx * dx + dy * dy));
+#endif
 }
\ No newline at end of file
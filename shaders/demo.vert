@@ -1,30 +1,53 @@
 #version 150  
+#ifdef GL_ARB_shader_draw_parameters
+#extension GL_ARB_shader_draw_parameters : enable
+#endif
+
+// Variantes: DEPTH_ONLY para el mapa de profundidad (solo la posicion)
 
 in vec3 aPosition;
+#ifndef DEPTH_ONLY
 in vec3 aNormal;
 in vec2 aTexCoord;
+#endif
 
-uniform mat4 uModelViewProjMatrix;
-uniform mat4 uModelViewMatrix;
-uniform mat3 uNormalMatrix;
-uniform mat4 uShadowMatrix;
-
-uniform int uDrawingShadowMap;
+struct DrawData {
+	mat4 modelViewProjMatrix;
+	mat4 modelViewMatrix;
+	mat3 normalMatrix;
+	mat4 shadowMatrix;
+	int material;
+};
+// MAX_DRAWS lo define el programa: los DrawData que caben en un bloque
+layout(std140) uniform DrawBlock {
+	DrawData uDraws[MAX_DRAWS];
+};
+uniform int uDrawBase; // Primer DrawData de la llamada en la ventana enlazada
 
+#ifndef DEPTH_ONLY
 out vec3 vECPos; // S.R. Vista
 out vec3 vECNorm; // S.R. Vista
 out vec4 vShadowTextCoord;
+flat out int vMaterial;
+#endif
 
 void main()
 {
-	if ( uDrawingShadowMap == 0 ) 
-	{
-		vECPos = vec3(uModelViewMatrix * vec4(aPosition, 1.0));
-		vECNorm = normalize(uNormalMatrix * aNormal);
+#ifdef GL_ARB_shader_draw_parameters
+	int drawIndex = uDrawBase + gl_DrawIDARB;
+#else
+	int drawIndex = uDrawBase;
+#endif
+	vec4 position = vec4(aPosition, 1.0);
+
+#ifndef DEPTH_ONLY
+	vECPos = vec3(uDraws[drawIndex].modelViewMatrix * position);
+	vECNorm = normalize(uDraws[drawIndex].normalMatrix * aNormal);
 
-		// Tarea por hacer: Calcular las coordenadas de textura del mapa de profudidad
-		vShadowTextCoord = uShadowMatrix * vec4(aPosition,1.0);
-	}
+	// Tarea por hacer: Calcular las coordenadas de textura del mapa de profudidad
+	vShadowTextCoord = uDraws[drawIndex].shadowMatrix * position;
+	vMaterial = uDraws[drawIndex].material;
+#endif
 
-	gl_Position = uModelViewProjMatrix * vec4(aPosition, 1.0);
+	gl_Position = uDraws[drawIndex].modelViewProjMatrix * position;
 }
\ No newline at end of file
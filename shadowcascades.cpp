@@ -0,0 +1,76 @@
+#include "shadowcascades.h"
+#include <cmath>
+#include <algorithm>
+
+void cascadeSplits(float near, float far, int n, float lambda, float *splits)
+{
+    for( int i = 1; i <= n; i++ )
+    {
+        float t = (float)i / n;
+        float logSplit = near * pow(far / near, t);
+        float uniformSplit = near + (far - near) * t;
+        splits[i - 1] = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+    }
+}
+
+glm::vec4 cascadeRegion(const glm::mat4 &lightViewProj, const glm::mat4 &invView,
+                        float fovy, float aspect, float near, float far)
+{
+    const glm::vec4 whole(-1.0f, -1.0f, 1.0f, 1.0f);
+    float tanY = tan(fovy * 0.5f * 3.14159265358979323846f / 180.0f);
+    float tanX = tanY * aspect;
+
+    float minX = 1.0f, maxX = -1.0f, minY = 1.0f, maxY = -1.0f;
+    for( int i = 0; i < 8; i++ )
+    {
+        float d = (i & 4) ? far : near;
+        glm::vec4 corner((i & 1 ? 1.0f : -1.0f) * tanX * d, (i & 2 ? 1.0f : -1.0f) * tanY * d, -d, 1.0f);
+        glm::vec4 clip = lightViewProj * (invView * corner);
+        if( clip.w <= 1e-4f )
+            return whole;
+
+        minX = std::min(minX, clip.x / clip.w);
+        maxX = std::max(maxX, clip.x / clip.w);
+        minY = std::min(minY, clip.y / clip.w);
+        maxY = std::max(maxY, clip.y / clip.w);
+    }
+
+    // Nothing outside the light frustum is worth texels
+    minX = std::max(minX, -1.0f);
+    maxX = std::min(maxX, 1.0f);
+    minY = std::max(minY, -1.0f);
+    maxY = std::min(maxY, 1.0f);
+    if( minX >= maxX || minY >= maxY )
+        return whole;
+    return glm::vec4(minX, minY, maxX, maxY);
+}
+
+glm::mat4 cascadeCropMatrix(const glm::vec4 &region)
+{
+    float sx = 2.0f / (region.z - region.x);
+    float sy = 2.0f / (region.w - region.y);
+    glm::mat4 crop(1.0f);
+    crop[0][0] = sx;
+    crop[1][1] = sy;
+    crop[3][0] = -0.5f * (region.z + region.x) * sx;
+    crop[3][1] = -0.5f * (region.w + region.y) * sy;
+    return crop;
+}
+
+bool cascadeCropUpdate(CascadeCrop &crop, const glm::mat4 &lightViewProj, const glm::mat4 &invView,
+                       float fovy, float aspect, float near, float far, float padding)
+{
+    glm::vec4 slice = cascadeRegion(lightViewProj, invView, fovy, aspect, near, far);
+    float w = slice.z - slice.x, h = slice.w - slice.y;
+    const glm::vec4 &kept = crop.region;
+    if( crop.valid &&
+        slice.x >= kept.x && slice.y >= kept.y && slice.z <= kept.z && slice.w <= kept.w &&
+        2.0f * w >= kept.z - kept.x && 2.0f * h >= kept.w - kept.y )
+        return false;
+
+    crop.region = glm::vec4(std::max(slice.x - padding * w, -1.0f), std::max(slice.y - padding * h, -1.0f),
+                            std::min(slice.z + padding * w, 1.0f), std::min(slice.w + padding * h, 1.0f));
+    crop.crop = cascadeCropMatrix(crop.region);
+    crop.valid = true;
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef SHADOWCASCADES_H
+#define SHADOWCASCADES_H
+
+#include <glm/glm.hpp>
+
+// Cascaded shadow maps. The camera frustum is split along its view axis and
+// each slice gets its own layer of the shadow map, with the light frustum
+// cropped to the slice so the layer's texels follow the camera.
+
+#define MAX_CASCADES 4
+
+// Far distance of each of n slices between near and far, blending a
+// logarithmic (lambda 1) and a uniform (lambda 0) split
+void cascadeSplits(float near, float far, int n, float lambda, float *splits);
+
+// Region (minX, minY, maxX, maxY) of light clip space, clamped to it, that
+// the camera frustum slice [near, far] covers. The camera has inverse view
+// matrix invView and vertical field of view fovy (degrees). The whole light
+// frustum if the slice reaches behind the light or misses it.
+glm::vec4 cascadeRegion(const glm::mat4 &lightViewProj, const glm::mat4 &invView,
+                        float fovy, float aspect, float near, float far);
+
+// Crop matrix, applied after lightViewProj, scaling the light clip space so
+// region fills it in x and y. Depth is left alone so casters between the
+// light and the slice still land in the map.
+glm::mat4 cascadeCropMatrix(const glm::vec4 &region);
+
+// A cascade's crop, kept across frames so camera moves alone leave its layer
+// of the map as it was. It is refitted, padded by padding times the slice's
+// size on each side, only once the slice leaves it or fills less than half
+// of it across.
+struct CascadeCrop {
+    bool valid;
+    glm::vec4 region;
+    glm::mat4 crop;
+};
+
+// Returns true if crop was refitted
+bool cascadeCropUpdate(CascadeCrop &crop, const glm::mat4 &lightViewProj, const glm::mat4 &invView,
+                       float fovy, float aspect, float near, float far, float padding);
+
+#endif // SHADOWCASCADES_H
@@ -0,0 +1,139 @@
+#include "uniformring.h"
+
+#include <cstring>
+
+static GLsizeiptr alignUp(GLsizeiptr x, GLint align)
+{
+    return (x + align - 1) / align * align;
+}
+
+// Creates the buffer for ring.segment and ring.bindSize
+static void createBuffer(UniformRing &ring)
+{
+    ring.frame = 0;
+    ring.used = 0;
+    ring.mapped = NULL;
+    for( int i = 0; i < UNIFORM_RING_FRAMES; i++ )
+        ring.fences[i] = 0;
+
+    GLsizeiptr size = ring.segment * UNIFORM_RING_FRAMES + ring.bindSize;
+    glGenBuffers(1, &ring.buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, ring.buffer);
+    ring.persistent = GLEW_ARB_buffer_storage != 0;
+    if( ring.persistent )
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, size, NULL, flags);
+        ring.mapped = (unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+        ring.persistent = ring.mapped != NULL;
+    }
+    if( !ring.persistent )
+        glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void uniformRingInit(UniformRing &ring, GLsizeiptr blockSize, int blocksPerFrame, GLsizeiptr bindSize)
+{
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ring.align);
+    if( ring.align <= 0 )
+        ring.align = 256;
+    ring.segment = alignUp(blockSize, ring.align) * blocksPerFrame;
+    ring.bindSize = bindSize;
+    createBuffer(ring);
+}
+
+void uniformRingDestroy(UniformRing &ring)
+{
+    for( int i = 0; i < UNIFORM_RING_FRAMES; i++ )
+        if( ring.fences[i] )
+            glDeleteSync(ring.fences[i]);
+    if( ring.persistent )
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, ring.buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &ring.buffer);
+    ring.buffer = 0;
+    ring.mapped = NULL;
+}
+
+GLsizeiptr uniformRingFrameSize(const UniformRing &ring, const GLsizeiptr *sizes, int count)
+{
+    GLsizeiptr total = 0;
+    for( int i = 0; i < count; i++ )
+        total += alignUp(sizes[i], ring.align);
+    return total;
+}
+
+void uniformRingReserve(UniformRing &ring, GLsizeiptr frameSize)
+{
+    if( frameSize <= ring.segment )
+        return;
+
+    // Doubling keeps a scene that grows a little each frame from
+    // replacing the buffer every frame
+    GLsizeiptr segment = ring.segment;
+    while( segment < frameSize )
+        segment *= 2;
+    for( int i = 0; i < UNIFORM_RING_FRAMES; i++ )
+        if( ring.fences[i] )
+            while( glClientWaitSync(ring.fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED )
+                ;
+    uniformRingDestroy(ring);
+    ring.segment = alignUp(segment, ring.align);
+    createBuffer(ring);
+}
+
+void uniformRingBeginFrame(UniformRing &ring)
+{
+    ring.frame = (ring.frame + 1) % UNIFORM_RING_FRAMES;
+    ring.used = 0;
+
+    GLsync &fence = ring.fences[ring.frame];
+    if( fence )
+    {
+        while( glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED )
+            ;
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    if( !ring.persistent )
+    {
+        // The fence already kept the GPU off this range, skip the driver's sync
+        glBindBuffer(GL_UNIFORM_BUFFER, ring.buffer);
+        ring.mapped = (unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, ring.frame * ring.segment, ring.segment,
+                                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                                                        GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+}
+
+GLintptr uniformRingWrite(UniformRing &ring, const void *data, GLsizeiptr size)
+{
+    GLsizeiptr offset = ring.used;
+    if( !ring.mapped || offset + size > ring.segment )
+        return -1;
+    ring.used = alignUp(offset + size, ring.align);
+
+    GLintptr base = ring.frame * ring.segment;
+    memcpy(ring.mapped + (ring.persistent ? base : 0) + offset, data, size);
+    return base + offset;
+}
+
+void uniformRingEndFrame(UniformRing &ring)
+{
+    if( !ring.persistent && ring.mapped )
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, ring.buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        ring.mapped = NULL;
+    }
+}
+
+void uniformRingFence(UniformRing &ring)
+{
+    ring.fences[ring.frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,49 @@
+#ifndef UNIFORMRING_H
+#define UNIFORMRING_H
+
+#include <GL/glew.h>
+
+// Ring of uniform buffer segments, one per frame in flight. Each frame's
+// per-draw blocks are written into the current segment once and then bound
+// with glBindBufferRange at their offset. The buffer stays persistently mapped
+// when ARB_buffer_storage is available; otherwise the segment is mapped with
+// glMapBufferRange for the frame. A fence guards a segment until the GPU is
+// done with it. The buffer runs bindSize bytes past its last segment, so a
+// range of that size bound at any block's offset stays inside it.
+
+#define UNIFORM_RING_FRAMES 3
+
+struct UniformRing {
+    GLuint buffer;
+    GLsizeiptr segment;         // bytes per frame
+    GLsizeiptr bindSize;        // largest range bound from a block
+    GLint align;                // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    int frame;                  // segment being written
+    GLsizeiptr used;            // bytes written to it so far
+    unsigned char *mapped;      // whole buffer when persistent, else the segment
+    bool persistent;
+    GLsync fences[UNIFORM_RING_FRAMES];
+};
+
+// Sizes each segment for blocksPerFrame blocks of at most blockSize bytes
+void uniformRingInit(UniformRing &ring, GLsizeiptr blockSize, int blocksPerFrame, GLsizeiptr bindSize = 0);
+void uniformRingDestroy(UniformRing &ring);
+
+// Bytes a frame needs for blocks of these sizes, padding included
+GLsizeiptr uniformRingFrameSize(const UniformRing &ring, const GLsizeiptr *sizes, int count);
+// Makes the segments hold at least frameSize bytes, waiting for the GPU to
+// release the buffer if it has to be replaced. Call between frames; offsets
+// returned before are invalid afterwards.
+void uniformRingReserve(UniformRing &ring, GLsizeiptr frameSize);
+
+// Waits for the segment to be free and maps it if needed
+void uniformRingBeginFrame(UniformRing &ring);
+// Copies a block into the segment, returns its offset in the buffer.
+// Returns -1 if the segment is full.
+GLintptr uniformRingWrite(UniformRing &ring, const void *data, GLsizeiptr size);
+// Unmaps the segment if needed. Draws reading it go after this.
+void uniformRingEndFrame(UniformRing &ring);
+// Fences the segment once the frame's draws have been issued
+void uniformRingFence(UniformRing &ring);
+
+#endif // UNIFORMRING_H
@@ -0,0 +1,48 @@
+#include "vboplane.h"
+
+void generatePlane(float * v, float * n, float * tex, unsigned int * el,
+                   float xsize, float zsize, int xdivs, int zdivs, int stride)
+{
+    int vstride = stride ? stride : 3;
+    int tstride = stride ? stride : 2;
+    float x2 = xsize / 2.0f;
+    float z2 = zsize / 2.0f;
+    float iFactor = (float)zsize / zdivs;
+    float jFactor = (float)xsize / xdivs;
+    float texi = 1.0f / zdivs;
+    float texj = 1.0f / xdivs;
+    float x, z;
+    int vidx = 0, tidx = 0;
+    for( int i = 0; i <= zdivs; i++ ) {
+        z = iFactor * i - z2;
+        for( int j = 0; j <= xdivs; j++ ) {
+            x = jFactor * j - x2;
+            v[vidx] = x;
+            v[vidx+1] = 0.0f;
+            v[vidx+2] = z;
+            n[vidx] = 0.0f;
+            n[vidx+1] = 1.0f;
+            n[vidx+2] = 0.0f;
+            vidx += vstride;
+            tex[tidx] = j * texi;
+            tex[tidx+1] = i * texj;
+            tidx += tstride;
+        }
+    }
+
+    unsigned int rowStart, nextRowStart;
+    int idx = 0;
+    for( int i = 0; i < zdivs; i++ ) {
+        rowStart = i * (xdivs+1);
+        nextRowStart = (i+1) * (xdivs+1);
+        for( int j = 0; j < xdivs; j++ ) {
+            el[idx] = rowStart + j;
+            el[idx+1] = nextRowStart + j;
+            el[idx+2] = nextRowStart + j + 1;
+            el[idx+3] = rowStart + j;
+            el[idx+4] = nextRowStart + j + 1;
+            el[idx+5] = rowStart + j + 1;
+            idx += 6;
+        }
+    }
+}
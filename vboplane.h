@@ -0,0 +1,7 @@
+#ifndef VBOPLANE_H
+#define VBOPLANE_H
+
+// stride: floats between consecutive vertices, 0 for tightly packed arrays
+void generatePlane(float *, float *, float *, unsigned int *, float, float, int, int, int stride = 0);
+
+#endif // VBOPLANE_H
@@ -0,0 +1,41 @@
+#include "vbosphere.h"
+#include <cmath>
+
+void generateSphere(float * v, float * n, float * t, unsigned short * el,
+                    float radius, unsigned int rings, unsigned int sectors, int stride)
+{
+    int vstride = stride ? stride : 3;
+    int tstride = stride ? stride : 2;
+    const float R = 1.0f/(float)(rings-1);
+    const float S = 1.0f/(float)(sectors-1);
+	const double PI = 3.14159265358979323846;
+
+    for(unsigned int r = 0; r < rings; r++) for(unsigned int s = 0; s < sectors; s++) {
+            float const y = float( sin( -PI/2 + PI * r * R ) );
+            float const x = float( cos(2*PI * s * S) * sin( PI * r * R ) );
+            float const z = float( sin(2*PI * s * S) * sin( PI * r * R ) );
+
+            t[0] = s*S;
+            t[1] = r*R;
+
+            v[0] = x * radius;
+            v[1] = y * radius;
+            v[2] = z * radius;
+
+            n[0] = x;
+            n[1] = y;
+            n[2] = z;
+
+            t += tstride;
+            v += vstride;
+            n += vstride;
+    }
+
+    unsigned short *i = el;
+    for(unsigned int r = 0; r < rings; r++) for(unsigned int s = 0; s < sectors; s++) {
+            *i++ = r * sectors + s;
+            *i++ = r * sectors + (s+1);
+            *i++ = (r+1) * sectors + (s+1);
+            *i++ = (r+1) * sectors + s;
+    }
+}
@@ -0,0 +1,7 @@
+#ifndef VBOSPHERE_H
+#define VBOSPHERE_H
+
+// stride: floats between consecutive vertices, 0 for tightly packed arrays
+void generateSphere(float *, float *, float *, unsigned short *, float, unsigned int, unsigned int, int stride = 0);
+
+#endif // VBOSPHERE_H
@@ -1,64 +1,239 @@
 #include "vboteapot.h"
 #include "teapotdata.h"
+#include "jobs.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 using glm::mat4;
 using glm::vec4;
 
-void generatePatches(float * v, float * n, float * tc, unsigned int* el, int grid) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define TEAPOT_HAVE_SSE 1
+#include <immintrin.h>
+#endif
+
+static TeapotKernel teapotKernel = TEAPOT_KERNEL_SIMD;
+
+void setTeapotKernel(TeapotKernel kernel) {
+    teapotKernel = kernel;
+}
+
+TeapotKernel getTeapotKernel() {
+    return teapotKernel;
+}
+
+// Reflections applied by buildPatchReflect, in the order the copies are emitted
+static const mat3 reflectNone(1.0f);
+static const mat3 reflectX(vec3(-1.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f));
+static const mat3 reflectY(vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f));
+static const mat3 reflectXY(vec3(-1.0f, 0.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f));
+
+// Source patches and the reflections used to complete the teapot
+static const struct {
+    bool reflectX, reflectY;
+} patchReflect[10] = {
+    { true, true },     // The rim
+    { true, true },     // The body
+    { true, true },
+    { true, true },     // The lid
+    { true, true },
+    { true, true },     // The bottom
+    { false, true },    // The handle
+    { false, true },
+    { false, true },    // The spout
+    { false, true }
+};
+
+// Part each source patch belongs to
+static const TeapotPart patchPart[10] = {
+    TEAPOT_RIM, TEAPOT_BODY, TEAPOT_BODY, TEAPOT_LID, TEAPOT_LID,
+    TEAPOT_BOTTOM, TEAPOT_HANDLE, TEAPOT_HANDLE, TEAPOT_SPOUT, TEAPOT_SPOUT
+};
+
+void getTeapotParts(int grid, MeshRange *parts) {
+    int vertsPerPatch = (grid + 1) * (grid + 1);
+    int elsPerPatch = 6 * grid * grid;
+
+    for( int i = 0; i < TEAPOT_PARTS; i++ ) {
+        parts[i].firstVertex = parts[i].nverts = 0;
+        parts[i].firstElement = parts[i].nelements = 0;
+    }
+
+    int vert = 0, elem = 0;
+    for( int p = 0; p < 10; p++ ) {
+        int copies = (patchReflect[p].reflectX ? 2 : 1) * (patchReflect[p].reflectY ? 2 : 1);
+        MeshRange &part = parts[patchPart[p]];
+        if( part.nverts == 0 ) {
+            part.firstVertex = vert;
+            part.firstElement = elem;
+        }
+        part.nverts += copies * vertsPerPatch;
+        part.nelements += copies * elsPerPatch;
+        vert += copies * vertsPerPatch;
+        elem += copies * elsPerPatch;
+    }
+}
+
+// One reflected copy of a source patch, i.e. one buildPatch call
+struct PatchInstance {
+    int patchNum;
+    bool reverseV;
+    const mat3 *reflect;
+    bool invertNormal;
+};
+
+// Lists the patch copies in the same order buildPatchReflect emits them
+static int listPatchInstances(PatchInstance *inst)
+{
+    int count = 0;
+    for( int p = 0; p < 10; p++ )
+    {
+        bool rx = patchReflect[p].reflectX, ry = patchReflect[p].reflectY;
+        PatchInstance base = { p, false, &reflectNone, true };
+        inst[count++] = base;
+        if( rx ) {
+            PatchInstance pi = { p, true, &reflectX, false };
+            inst[count++] = pi;
+        }
+        if( ry ) {
+            PatchInstance pi = { p, true, &reflectY, false };
+            inst[count++] = pi;
+        }
+        if( rx && ry ) {
+            PatchInstance pi = { p, false, &reflectXY, true };
+            inst[count++] = pi;
+        }
+    }
+    return count;
+}
+
+void generatePatches(float * v, float * n, float * tc, unsigned int* el, int grid, bool parallel, int stride,
+                     MeshRange *parts) {
     float * B = new float[4*(grid+1)];  // Pre-computed Bernstein basis functions
     float * dB = new float[4*(grid+1)]; // Pre-computed derivitives of basis functions
 
-    int idx = 0, elIndex = 0, tcIndex = 0;
-
     // Pre-compute the basis functions  (Bernstein polynomials)
     // and their derivatives
     computeBasisFunctions(B, dB, grid);
 
-    // Build each patch
-    // The rim
-    buildPatchReflect(0, B, dB, v, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
-    // The body
-    buildPatchReflect(1, B, dB, v, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
-    buildPatchReflect(2, B, dB, v, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
-    // The lid
-    buildPatchReflect(3, B, dB, v, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
-    buildPatchReflect(4, B, dB, v, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
-    // The bottom
-    buildPatchReflect(5, B, dB, v, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
-    // The handle
-    buildPatchReflect(6, B, dB, v, n, tc, el, idx, elIndex, tcIndex, grid, false, true);
-    buildPatchReflect(7, B, dB, v, n, tc, el, idx, elIndex, tcIndex, grid, false, true);
-    // The spout
-    buildPatchReflect(8, B, dB, v, n, tc, el, idx, elIndex, tcIndex, grid, false, true);
-    buildPatchReflect(9, B, dB, v, n, tc, el, idx, elIndex, tcIndex, grid, false, true);
+    if( !parallel ) {
+        int idx = 0, elIndex = 0, tcIndex = 0;
+
+        // Build each patch
+        for( int p = 0; p < 10; p++ )
+            buildPatchReflect(p, B, dB, v, n, tc, el, idx, elIndex, tcIndex, grid,
+                              patchReflect[p].reflectX, patchReflect[p].reflectY, stride);
+    } else {
+        // Every patch writes a fixed amount of data, so its output offsets are
+        // known up front and the patches can be built independently.
+        PatchInstance inst[TEAPOT_PATCHES];
+        int count = listPatchInstances(inst);
+        int vertsPerPatch = (grid + 1) * (grid + 1);
+        int vstride = stride ? stride : 3;
+        int tstride = stride ? stride : 2;
+        int elsPerPatch = 6 * grid * grid;
+
+        parallelFor(count, 1, [&](int begin, int end) {
+            for( int k = begin; k < end; k++ )
+            {
+                vec3 patch[4][4];
+                getPatch(inst[k].patchNum, patch, inst[k].reverseV);
+
+                int idx = vstride * k * vertsPerPatch;
+                int tcIndex = tstride * k * vertsPerPatch;
+                int elIndex = k * elsPerPatch;
+                buildPatch(patch, B, dB, v, n, tc, el,
+                           idx, elIndex, tcIndex, grid, *inst[k].reflect, inst[k].invertNormal, stride);
+            }
+        });
+    }
 
     delete [] B;
     delete [] dB;
+
+    if( parts )
+        getTeapotParts(grid, parts);
 }
 
-void moveLid(int grid, float *v, mat4 lidTransform) {
+void transformVertices(float *v, float *n, int first, int count, const mat4 &m, int stride) {
+    int vstride = stride ? stride : 3;
+    mat3 nm = glm::transpose(glm::inverse(mat3(m)));
+    int i = first, end = first + count;
 
-//    int start = 3 * 12 * (grid+1) * (grid+1);
-//    int end = 3 * 20 * (grid+1) * (grid+1);
-	int nverts = 32 * (grid + 1) * (grid + 1);
-    
-	for( int i = 0; i < 3 * nverts; i += 3 )
-    {
-        vec4 vert = vec4(v[i], v[i+1], v[i+2], 1.0f );
-        vert = lidTransform * vert;
-        v[i] = vert.x;
-        v[i+1] = vert.y;
-        v[i+2] = vert.z;
+#ifdef TEAPOT_HAVE_SSE
+    // Four vertices per step: gather x, y and z into one register each and
+    // accumulate the matrix columns, the same products as the scalar path
+    __m128 m0[4], m1[4], m2[4], n0[3], n1[3], n2[3];
+    for( int c = 0; c < 4; c++ ) {
+        m0[c] = _mm_set1_ps(m[c][0]);
+        m1[c] = _mm_set1_ps(m[c][1]);
+        m2[c] = _mm_set1_ps(m[c][2]);
+    }
+    for( int c = 0; c < 3; c++ ) {
+        n0[c] = _mm_set1_ps(nm[c][0]);
+        n1[c] = _mm_set1_ps(nm[c][1]);
+        n2[c] = _mm_set1_ps(nm[c][2]);
+    }
+    for( ; i + 4 <= end; i += 4 ) {
+        float *p[4] = { v + i * vstride, v + (i + 1) * vstride, v + (i + 2) * vstride, v + (i + 3) * vstride };
+        __m128 x = _mm_setr_ps(p[0][0], p[1][0], p[2][0], p[3][0]);
+        __m128 y = _mm_setr_ps(p[0][1], p[1][1], p[2][1], p[3][1]);
+        __m128 z = _mm_setr_ps(p[0][2], p[1][2], p[2][2], p[3][2]);
+        __m128 r[3];
+        r[0] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m0[0], x), _mm_mul_ps(m0[1], y)), _mm_mul_ps(m0[2], z)), m0[3]);
+        r[1] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m1[0], x), _mm_mul_ps(m1[1], y)), _mm_mul_ps(m1[2], z)), m1[3]);
+        r[2] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m2[0], x), _mm_mul_ps(m2[1], y)), _mm_mul_ps(m2[2], z)), m2[3]);
+        float out[3][4];
+        for( int k = 0; k < 3; k++ )
+            _mm_storeu_ps(out[k], r[k]);
+        for( int j = 0; j < 4; j++ )
+            for( int k = 0; k < 3; k++ )
+                p[j][k] = out[k][j];
+
+        if( n ) {
+            float *q[4] = { n + i * vstride, n + (i + 1) * vstride, n + (i + 2) * vstride, n + (i + 3) * vstride };
+            x = _mm_setr_ps(q[0][0], q[1][0], q[2][0], q[3][0]);
+            y = _mm_setr_ps(q[0][1], q[1][1], q[2][1], q[3][1]);
+            z = _mm_setr_ps(q[0][2], q[1][2], q[2][2], q[3][2]);
+            r[0] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n0[0], x), _mm_mul_ps(n0[1], y)), _mm_mul_ps(n0[2], z));
+            r[1] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n1[0], x), _mm_mul_ps(n1[1], y)), _mm_mul_ps(n1[2], z));
+            r[2] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n2[0], x), _mm_mul_ps(n2[1], y)), _mm_mul_ps(n2[2], z));
+            for( int k = 0; k < 3; k++ )
+                _mm_storeu_ps(out[k], r[k]);
+            for( int j = 0; j < 4; j++ )
+                for( int k = 0; k < 3; k++ )
+                    q[j][k] = out[k][j];
+        }
+    }
+#endif
+
+    for( ; i < end; i++ ) {
+        float *p = v + i * vstride;
+        vec4 vert = m * vec4(p[0], p[1], p[2], 1.0f);
+        p[0] = vert.x;
+        p[1] = vert.y;
+        p[2] = vert.z;
+        if( n ) {
+            float *q = n + i * vstride;
+            vec3 norm = nm * vec3(q[0], q[1], q[2]);
+            q[0] = norm.x;
+            q[1] = norm.y;
+            q[2] = norm.z;
+        }
     }
 }
 
+void moveLid(int grid, float *v, float *n, mat4 lidTransform, int stride) {
+    MeshRange parts[TEAPOT_PARTS];
+    getTeapotParts(grid, parts);
+    transformVertices(v, n, parts[TEAPOT_LID].firstVertex, parts[TEAPOT_LID].nverts, lidTransform, stride);
+}
+
 void buildPatchReflect(int patchNum,
                                     float *B, float *dB,
                                     float *v, float *n,
                                     float *tc, unsigned int *el,
                                     int &index, int &elIndex, int &tcIndex, int grid,
-                                    bool reflectX, bool reflectY)
+                                    bool reflectX, bool reflectY, int stride)
 {
     vec3 patch[4][4];
     vec3 patchRevV[4][4];
@@ -67,30 +242,24 @@ void buildPatchReflect(int patchNum,
 
     // Patch without modification
     buildPatch(patch, B, dB, v, n, tc, el,
-               index, elIndex, tcIndex, grid, mat3(1.0f), true);
+               index, elIndex, tcIndex, grid, reflectNone, true, stride);
 
     // Patch reflected in x
     if( reflectX ) {
         buildPatch(patchRevV, B, dB, v, n, tc, el,
-                   index, elIndex, tcIndex, grid, mat3(vec3(-1.0f, 0.0f, 0.0f),
-                                              vec3(0.0f, 1.0f, 0.0f),
-                                              vec3(0.0f, 0.0f, 1.0f) ), false );
+                   index, elIndex, tcIndex, grid, ::reflectX, false, stride );
     }
 
     // Patch reflected in y
     if( reflectY ) {
         buildPatch(patchRevV, B, dB, v, n, tc, el,
-                   index, elIndex, tcIndex, grid, mat3(vec3(1.0f, 0.0f, 0.0f),
-                                              vec3(0.0f, -1.0f, 0.0f),
-                                              vec3(0.0f, 0.0f, 1.0f) ), false );
+                   index, elIndex, tcIndex, grid, ::reflectY, false, stride );
     }
 
     // Patch reflected in x and y
     if( reflectX && reflectY ) {
         buildPatch(patch, B, dB, v, n, tc, el,
-                   index, elIndex, tcIndex, grid, mat3(vec3(-1.0f, 0.0f, 0.0f),
-                                              vec3(0.0f, -1.0f, 0.0f),
-                                              vec3(0.0f, 0.0f, 1.0f) ), true );
+                   index, elIndex, tcIndex, grid, reflectXY, true, stride );
     }
 }
 
@@ -99,17 +268,23 @@ void buildPatch(vec3 patch[][4],
                            float *v, float *n, float *tc,
                            unsigned int *el,
                            int &index, int &elIndex, int &tcIndex, int grid, mat3 reflect,
-                           bool invertNormal)
+                           bool invertNormal, int stride)
 {
-    int startIndex = index / 3;
+    // Floats between consecutive vertices, 0 means tightly packed arrays
+    int vstride = stride ? stride : 3;
+    int tstride = stride ? stride : 2;
+    int startIndex = index / vstride;
     float tcFactor = 1.0f / grid;
+    vec3 * rowPts = new vec3[grid+1];
+    vec3 * rowNorms = new vec3[grid+1];
 
     for( int i = 0; i <= grid; i++ )
     {
+        evaluateRow(i, grid, B, dB, patch, rowPts, rowNorms);
         for( int j = 0 ; j <= grid; j++)
         {
-            vec3 pt = reflect * evaluate(i,j,B,patch);
-            vec3 norm = reflect * evaluateNormal(i,j,B,dB,patch);
+            vec3 pt = reflect * rowPts[j];
+            vec3 norm = reflect * rowNorms[j];
             if( invertNormal )
                 norm = -norm;
 
@@ -124,10 +299,12 @@ void buildPatch(vec3 patch[][4],
             tc[tcIndex] = i * tcFactor;
             tc[tcIndex+1] = j * tcFactor;
 
-            index += 3;
-            tcIndex += 2;
+            index += vstride;
+            tcIndex += tstride;
         }
     }
+    delete [] rowPts;
+    delete [] rowNorms;
 
     for( int i = 0; i < grid; i++ )
     {
@@ -216,6 +393,206 @@ vec3 evaluateNormal( int gridU, int gridV, float *B, float *dB, vec3 patch[][4]
     return glm::normalize( glm::cross( du, dv ) );
 }
 
+// Vectorized kernels. Each evaluates the position and normal of several
+// consecutive grid points of a row (fixed gridU) at once, one point per lane.
+// They follow the operation order of evaluate/evaluateNormal, so their output
+// matches the scalar path.
+#ifdef TEAPOT_HAVE_SSE
+
+// Loads B[(v0+l)*4 + j] into lane l of out[j]
+static inline void loadBasis4(const float *B, int v0, __m128 out[4])
+{
+    out[0] = _mm_loadu_ps(B + v0*4);
+    out[1] = _mm_loadu_ps(B + v0*4 + 4);
+    out[2] = _mm_loadu_ps(B + v0*4 + 8);
+    out[3] = _mm_loadu_ps(B + v0*4 + 12);
+    _MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
+}
+
+static void evaluate4SSE( int gridU, int v0, const float *B, const float *dB, vec3 patch[][4],
+                          vec3 *pts, vec3 *norms )
+{
+    __m128 bv[4], dbv[4];
+    loadBasis4(B, v0, bv);
+    loadBasis4(dB, v0, dbv);
+
+    __m128 px = _mm_setzero_ps(), py = _mm_setzero_ps(), pz = _mm_setzero_ps();
+    __m128 dux = _mm_setzero_ps(), duy = _mm_setzero_ps(), duz = _mm_setzero_ps();
+    __m128 dvx = _mm_setzero_ps(), dvy = _mm_setzero_ps(), dvz = _mm_setzero_ps();
+
+    for( int i = 0; i < 4; i++) {
+        float bu = B[gridU*4+i];
+        float dbu = dB[gridU*4+i];
+        for( int j = 0; j < 4; j++) {
+            vec3 cp = patch[i][j];
+            __m128 cx = _mm_set1_ps(cp.x * bu), cy = _mm_set1_ps(cp.y * bu), cz = _mm_set1_ps(cp.z * bu);
+            __m128 dx = _mm_set1_ps(cp.x * dbu), dy = _mm_set1_ps(cp.y * dbu), dz = _mm_set1_ps(cp.z * dbu);
+
+            px = _mm_add_ps(px, _mm_mul_ps(cx, bv[j]));
+            py = _mm_add_ps(py, _mm_mul_ps(cy, bv[j]));
+            pz = _mm_add_ps(pz, _mm_mul_ps(cz, bv[j]));
+
+            dux = _mm_add_ps(dux, _mm_mul_ps(dx, bv[j]));
+            duy = _mm_add_ps(duy, _mm_mul_ps(dy, bv[j]));
+            duz = _mm_add_ps(duz, _mm_mul_ps(dz, bv[j]));
+
+            dvx = _mm_add_ps(dvx, _mm_mul_ps(cx, dbv[j]));
+            dvy = _mm_add_ps(dvy, _mm_mul_ps(cy, dbv[j]));
+            dvz = _mm_add_ps(dvz, _mm_mul_ps(cz, dbv[j]));
+        }
+    }
+
+    // normalize( cross( du, dv ) )
+    __m128 nx = _mm_sub_ps(_mm_mul_ps(duy, dvz), _mm_mul_ps(dvy, duz));
+    __m128 ny = _mm_sub_ps(_mm_mul_ps(duz, dvx), _mm_mul_ps(dvz, dux));
+    __m128 nz = _mm_sub_ps(_mm_mul_ps(dux, dvy), _mm_mul_ps(dvx, duy));
+    __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+    __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(len2));
+    nx = _mm_mul_ps(nx, inv);
+    ny = _mm_mul_ps(ny, inv);
+    nz = _mm_mul_ps(nz, inv);
+
+    float out[6][4];
+    _mm_storeu_ps(out[0], px);
+    _mm_storeu_ps(out[1], py);
+    _mm_storeu_ps(out[2], pz);
+    _mm_storeu_ps(out[3], nx);
+    _mm_storeu_ps(out[4], ny);
+    _mm_storeu_ps(out[5], nz);
+    for( int l = 0; l < 4; l++ ) {
+        pts[l] = vec3(out[0][l], out[1][l], out[2][l]);
+        norms[l] = vec3(out[3][l], out[4][l], out[5][l]);
+    }
+}
+
+__attribute__((target("avx")))
+static inline __m256 loadBasis8(const float *B, int v0, int j)
+{
+    __m128 lo[4], hi[4];
+    loadBasis4(B, v0, lo);
+    loadBasis4(B, v0 + 4, hi);
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo[j]), hi[j], 1);
+}
+
+__attribute__((target("avx")))
+static void evaluate8AVX( int gridU, int v0, const float *B, const float *dB, vec3 patch[][4],
+                          vec3 *pts, vec3 *norms )
+{
+    __m256 bv[4], dbv[4];
+    for( int j = 0; j < 4; j++ ) {
+        bv[j] = loadBasis8(B, v0, j);
+        dbv[j] = loadBasis8(dB, v0, j);
+    }
+
+    __m256 px = _mm256_setzero_ps(), py = _mm256_setzero_ps(), pz = _mm256_setzero_ps();
+    __m256 dux = _mm256_setzero_ps(), duy = _mm256_setzero_ps(), duz = _mm256_setzero_ps();
+    __m256 dvx = _mm256_setzero_ps(), dvy = _mm256_setzero_ps(), dvz = _mm256_setzero_ps();
+
+    for( int i = 0; i < 4; i++) {
+        float bu = B[gridU*4+i];
+        float dbu = dB[gridU*4+i];
+        for( int j = 0; j < 4; j++) {
+            vec3 cp = patch[i][j];
+            __m256 cx = _mm256_set1_ps(cp.x * bu), cy = _mm256_set1_ps(cp.y * bu), cz = _mm256_set1_ps(cp.z * bu);
+            __m256 dx = _mm256_set1_ps(cp.x * dbu), dy = _mm256_set1_ps(cp.y * dbu), dz = _mm256_set1_ps(cp.z * dbu);
+
+            px = _mm256_add_ps(px, _mm256_mul_ps(cx, bv[j]));
+            py = _mm256_add_ps(py, _mm256_mul_ps(cy, bv[j]));
+            pz = _mm256_add_ps(pz, _mm256_mul_ps(cz, bv[j]));
+
+            dux = _mm256_add_ps(dux, _mm256_mul_ps(dx, bv[j]));
+            duy = _mm256_add_ps(duy, _mm256_mul_ps(dy, bv[j]));
+            duz = _mm256_add_ps(duz, _mm256_mul_ps(dz, bv[j]));
+
+            dvx = _mm256_add_ps(dvx, _mm256_mul_ps(cx, dbv[j]));
+            dvy = _mm256_add_ps(dvy, _mm256_mul_ps(cy, dbv[j]));
+            dvz = _mm256_add_ps(dvz, _mm256_mul_ps(cz, dbv[j]));
+        }
+    }
+
+    __m256 nx = _mm256_sub_ps(_mm256_mul_ps(duy, dvz), _mm256_mul_ps(dvy, duz));
+    __m256 ny = _mm256_sub_ps(_mm256_mul_ps(duz, dvx), _mm256_mul_ps(dvz, dux));
+    __m256 nz = _mm256_sub_ps(_mm256_mul_ps(dux, dvy), _mm256_mul_ps(dvx, duy));
+    __m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)), _mm256_mul_ps(nz, nz));
+    __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(len2));
+    nx = _mm256_mul_ps(nx, inv);
+    ny = _mm256_mul_ps(ny, inv);
+    nz = _mm256_mul_ps(nz, inv);
+
+    float out[6][8];
+    _mm256_storeu_ps(out[0], px);
+    _mm256_storeu_ps(out[1], py);
+    _mm256_storeu_ps(out[2], pz);
+    _mm256_storeu_ps(out[3], nx);
+    _mm256_storeu_ps(out[4], ny);
+    _mm256_storeu_ps(out[5], nz);
+    for( int l = 0; l < 8; l++ ) {
+        pts[l] = vec3(out[0][l], out[1][l], out[2][l]);
+        norms[l] = vec3(out[3][l], out[4][l], out[5][l]);
+    }
+}
+
+static bool cpuHasAVX()
+{
+    static const bool avx = __builtin_cpu_supports("avx");
+    return avx;
+}
+
+#endif // TEAPOT_HAVE_SSE
+
+// Collapses the control net against the u-basis of row gridU. The surface
+// along the row is then the cubic curve with control points Q, and dQ is the
+// same for the u-derivative.
+void computeRowCurves( int gridU, float *B, float *dB, vec3 patch[][4], vec3 *Q, vec3 *dQ )
+{
+    for( int j = 0; j < 4; j++) {
+        Q[j] = vec3(0.0f,0.0f,0.0f);
+        dQ[j] = vec3(0.0f,0.0f,0.0f);
+        for( int i = 0; i < 4; i++) {
+            Q[j] += patch[i][j] * B[gridU*4+i];
+            dQ[j] += patch[i][j] * dB[gridU*4+i];
+        }
+    }
+}
+
+void evaluateRow( int gridU, int grid, float *B, float *dB, vec3 patch[][4],
+                  vec3 *pts, vec3 *norms )
+{
+    int j = 0;
+    if( teapotKernel == TEAPOT_KERNEL_SEPARABLE ) {
+        vec3 Q[4], dQ[4];
+        computeRowCurves(gridU, B, dB, patch, Q, dQ);
+        for( ; j <= grid; j++ ) {
+            vec3 p(0.0f,0.0f,0.0f);
+            vec3 du(0.0f,0.0f,0.0f);
+            vec3 dv(0.0f,0.0f,0.0f);
+            for( int k = 0; k < 4; k++) {
+                p += Q[k] * B[j*4+k];
+                du += dQ[k] * B[j*4+k];
+                dv += Q[k] * dB[j*4+k];
+            }
+            pts[j] = p;
+            norms[j] = glm::normalize( glm::cross( du, dv ) );
+        }
+        return;
+    }
+#ifdef TEAPOT_HAVE_SSE
+    if( teapotKernel == TEAPOT_KERNEL_SIMD ) {
+        if( cpuHasAVX() ) {
+            for( ; j + 8 <= grid + 1; j += 8 )
+                evaluate8AVX(gridU, j, B, dB, patch, pts + j, norms + j);
+        }
+        for( ; j + 4 <= grid + 1; j += 4 )
+            evaluate4SSE(gridU, j, B, dB, patch, pts + j, norms + j);
+    }
+#endif
+    // Scalar kernel, also used for the points left over by the SIMD kernels
+    for( ; j <= grid; j++ ) {
+        pts[j] = evaluate(gridU, j, B, patch);
+        norms[j] = evaluateNormal(gridU, j, B, dB, patch);
+    }
+}
+
 /*
 void render()  {
     glBindVertexArray(vaoHandle);
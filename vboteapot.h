@@ -2,25 +2,68 @@
 #define VBOTEAPOT_H
 
 #include <glm/glm.hpp>
+#include "vertexformat.h"
 using glm::vec3;
 using glm::mat3;
 using glm::mat4;
 
-void generatePatches(float * v, float * n, float *tc, unsigned int* el, int grid);
+// Number of patches generatePatches emits (10 source patches plus reflections)
+#define TEAPOT_PATCHES 32
+
+// Welding parameters for the patch seams (see weldVertices)
+#define TEAPOT_WELD_TOLERANCE 1e-4f
+#define TEAPOT_CREASE_ANGLE 30.0f
+
+// Named parts of the teapot. generatePatches emits the patches of each part
+// contiguously and in this order, so every part is one MeshRange.
+enum TeapotPart {
+    TEAPOT_RIM,
+    TEAPOT_BODY,
+    TEAPOT_LID,
+    TEAPOT_BOTTOM,
+    TEAPOT_HANDLE,
+    TEAPOT_SPOUT,
+    TEAPOT_PARTS
+};
+
+// stride is the number of floats between consecutive vertices in v, n and tc;
+// 0 means separate tightly packed arrays (3, 3 and 2 floats per vertex).
+// parts, if given, receives the TEAPOT_PARTS ranges.
+void generatePatches(float * v, float * n, float *tc, unsigned int* el, int grid, bool parallel = false, int stride = 0,
+                     MeshRange *parts = 0);
+void getTeapotParts(int grid, MeshRange *parts);
 void buildPatchReflect(int patchNum,
                         float *B, float *dB,
                         float *v, float *n, float *, unsigned int *el,
                         int &index, int &elIndex, int &, int grid,
-                        bool reflectX, bool reflectY);
+                        bool reflectX, bool reflectY, int stride);
 void buildPatch(vec3 patch[][4],
                 float *B, float *dB,
                 float *v, float *n,float *, unsigned int *el,
-                int &index, int &elIndex, int &, int grid, mat3 reflect, bool invertNormal);
+                int &index, int &elIndex, int &, int grid, mat3 reflect, bool invertNormal, int stride);
 void getPatch( int patchNum, vec3 patch[][4], bool reverseV );
 
+// Kernel used to evaluate the Bezier patches. TEAPOT_KERNEL_SIMD uses AVX or
+// SSE when the CPU has them and falls back to the scalar code otherwise.
+// TEAPOT_KERNEL_SEPARABLE factors the u-basis out of each row first; it
+// differs from the other two only by rounding.
+enum TeapotKernel {
+    TEAPOT_KERNEL_SCALAR,
+    TEAPOT_KERNEL_SIMD,
+    TEAPOT_KERNEL_SEPARABLE
+};
+void setTeapotKernel(TeapotKernel kernel);
+TeapotKernel getTeapotKernel();
+
 void computeBasisFunctions( float * B, float * dB, int grid );
 vec3 evaluate( int gridU, int gridV, float *B, vec3 patch[][4] );
 vec3 evaluateNormal( int gridU, int gridV, float *B, float *dB, vec3 patch[][4] );
-void moveLid(int,float *,mat4);
+void computeRowCurves( int gridU, float *B, float *dB, vec3 patch[][4], vec3 *Q, vec3 *dQ );
+void evaluateRow( int gridU, int grid, float *B, float *dB, vec3 patch[][4], vec3 *pts, vec3 *norms );
+// Applies m to count vertices from first on the CPU, four at a time with SSE,
+// for offline export. Normals, if given, get the inverse transpose.
+void transformVertices(float *v, float *n, int first, int count, const mat4 &m, int stride = 0);
+// Transforms the lid part of a freshly generated teapot
+void moveLid(int grid, float *v, float *n, mat4 lidTransform, int stride = 0);
 
 #endif // VBOTEAPOT_H
@@ -3,11 +3,13 @@
 
 void generateVerts(float * verts, float * norms, float * tex, unsigned int * el, 
 				   float outerRadius, float innerRadius,
-				   int rings, int sides)
+				   int rings, int sides, int stride)
 {
 	const double TWOPI = 2* 3.14159265358979323846;
     float ringFactor  = (float)(TWOPI / rings);
     float sideFactor = (float)(TWOPI / sides);
+    int vstride = stride ? stride : 3;
+    int tstride = stride ? stride : 2;
     int idx = 0, tidx = 0;
     for( int ring = 0; ring <= rings; ring++ ) {
         float u = ring * ringFactor;
@@ -26,7 +28,7 @@ void generateVerts(float * verts, float * norms, float * tex, unsigned int * el,
             norms[idx + 2] = sv * r;
             tex[tidx] = (float)(u / TWOPI);
             tex[tidx+1] = (float)(v / TWOPI);
-            tidx += 2;
+            tidx += tstride;
             // Normalize
             float len = sqrt( norms[idx] * norms[idx] +
                               norms[idx+1] * norms[idx+1] +
@@ -34,7 +36,7 @@ void generateVerts(float * verts, float * norms, float * tex, unsigned int * el,
             norms[idx] /= len;
             norms[idx+1] /= len;
             norms[idx+2] /= len;
-            idx += 3;
+            idx += vstride;
         }
     }
 
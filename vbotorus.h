@@ -1,6 +1,7 @@
 #ifndef VBOTORUS_H
 #define VBOTORUS_H
 
-void generateVerts(float * , float * ,float *, unsigned int *, float , float, int, int);
+// stride: floats between consecutive vertices, 0 for tightly packed arrays
+void generateVerts(float * , float * ,float *, unsigned int *, float , float, int, int, int stride = 0);
 
 #endif // VBOTORUS_H
@@ -0,0 +1,29 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <cstddef>
+
+// Interleaved vertex layout shared by all meshes: one buffer with a single
+// stride instead of separate position, normal and texcoord arrays
+struct Vertex {
+    float position[3];
+    float normal[3];
+    float texCoord[2];
+};
+
+#define VERTEX_FLOATS       (sizeof(Vertex) / sizeof(float))
+#define VERTEX_NORMAL_OFS   (offsetof(Vertex, normal) / sizeof(float))
+#define VERTEX_TEXCOORD_OFS (offsetof(Vertex, texCoord) / sizeof(float))
+
+// A contiguous run of vertices and the triangles that only reference them,
+// used for the named parts of a mesh
+struct MeshRange {
+    int firstVertex;
+    int nverts;
+    int firstElement;
+    int nelements;
+};
+
+#define MESH_MAX_RANGES 8
+
+#endif // VERTEXFORMAT_H